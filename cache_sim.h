@@ -0,0 +1,1584 @@
+// Núcleo do simulador como biblioteca só de cabeçalho: Cache<Addr> (32 ou
+// 64 bits), CacheStats e o classificador 3C exato, no namespace cache_sim.
+// O anel de memória compartilhada do modo --serve está em cache_sim_shm.h.
+//
+// API estável (CACHE_SIM_API_VERSION):
+//   Cache<Addr>(nsets, bsize, assoc, Replacement)
+//   seed_random(seed), access(addr), access_batch(addrs, n), stats(),
+//   save(f), load(f)
+//   CacheStats, Replacement, OP_*
+// O que está em cache_sim::detail (detail::CacheEngine e os kernels) é o
+// motor do simulador e não faz parte da API.
+#ifndef CACHE_SIM_H
+#define CACHE_SIM_H
+
+#include <vector>
+#include <cstdint>
+#include <cinttypes>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CACHE_SIM_TAG_MATCH_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define CACHE_SIM_API_VERSION 1
+
+namespace cache_sim {
+
+enum class Replacement { LRU, FIFO, RANDOM, PLRU_TREE, PLRU_BIT, SRRIP, BRRIP, DRRIP };
+
+// Tipo de operação de cada registro do trace R/W
+enum : uint8_t { OP_READ = 0, OP_WRITE = 1, OP_IFETCH = 2 };
+
+// Motor interno: pode mudar sem aviso, fora da API estável
+namespace detail {
+
+inline bool is_pow2(uint32_t v) {
+    return v != 0 && (v & (v - 1)) == 0;
+}
+
+constexpr uint32_t ilog2(uint32_t v) {
+    uint32_t r = 0;
+    while (v >>= 1) r++;
+    return r;
+}
+
+inline uint32_t ctz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    uint32_t r = 0;
+    while (!(v & 1)) { v >>= 1; r++; }
+    return r;
+#endif
+}
+
+// Prefetch das linhas de 64 bytes que cobrem [p, p + bytes)
+inline void prefetch_lines(const void* p, size_t bytes) {
+#if defined(__GNUC__)
+    uintptr_t end = reinterpret_cast<uintptr_t>(p) + bytes;
+    for (uintptr_t a = reinterpret_cast<uintptr_t>(p) & ~uintptr_t(63); a < end; a += 64)
+        __builtin_prefetch(reinterpret_cast<const void*>(a));
+#else
+    (void)p;
+    (void)bytes;
+#endif
+}
+
+// Kernels de comparação de tags: retornam a máscara (bit i = way i) das
+// n <= 64 posições de tags iguais a tag. T é o tipo da tag (32 ou 64 bits).
+template<typename T>
+using TagMatchFn = uint64_t (*)(const T* tags, uint32_t n, T tag);
+
+template<typename T>
+uint64_t tag_match_scalar(const T* tags, uint32_t n, T tag) {
+    uint64_t m = 0;
+    for (uint32_t i = 0; i < n; ++i)
+        m |= uint64_t(tags[i] == tag) << i;
+    return m;
+}
+
+#ifdef CACHE_SIM_TAG_MATCH_X86
+__attribute__((target("sse2")))
+inline uint64_t tag_match_sse2(const uint32_t* tags, uint32_t n, uint32_t tag) {
+    const __m128i t = _mm_set1_epi32(static_cast<int>(tag));
+    uint64_t m = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags + i));
+        uint32_t eq = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, t)));
+        m |= uint64_t(eq) << i;
+    }
+    for (; i < n; ++i)
+        m |= uint64_t(tags[i] == tag) << i;
+    return m;
+}
+
+__attribute__((target("avx2")))
+inline uint64_t tag_match_avx2(const uint32_t* tags, uint32_t n, uint32_t tag) {
+    const __m256i t = _mm256_set1_epi32(static_cast<int>(tag));
+    uint64_t m = 0;
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tags + i));
+        uint32_t eq = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, t)));
+        m |= uint64_t(eq) << i;
+    }
+    for (; i < n; ++i)
+        m |= uint64_t(tags[i] == tag) << i;
+    return m;
+}
+
+// Tags de 64 bits: a comparação de 64 bits chega no SSE4.1
+__attribute__((target("sse4.1")))
+inline uint64_t tag_match_sse41(const uint64_t* tags, uint32_t n, uint64_t tag) {
+    const __m128i t = _mm_set1_epi64x(static_cast<long long>(tag));
+    uint64_t m = 0;
+    uint32_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags + i));
+        uint32_t eq = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, t)));
+        m |= uint64_t(eq) << i;
+    }
+    for (; i < n; ++i)
+        m |= uint64_t(tags[i] == tag) << i;
+    return m;
+}
+
+__attribute__((target("avx2")))
+inline uint64_t tag_match_avx2(const uint64_t* tags, uint32_t n, uint64_t tag) {
+    const __m256i t = _mm256_set1_epi64x(static_cast<long long>(tag));
+    uint64_t m = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tags + i));
+        uint32_t eq = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, t)));
+        m |= uint64_t(eq) << i;
+    }
+    for (; i < n; ++i)
+        m |= uint64_t(tags[i] == tag) << i;
+    return m;
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+inline uint64_t tag_match_neon(const uint32_t* tags, uint32_t n, uint32_t tag) {
+    const uint32x4_t t = vdupq_n_u32(tag);
+    const uint32_t w[4] = {1, 2, 4, 8};
+    const uint32x4_t weights = vld1q_u32(w);
+    uint64_t m = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32x4_t eq = vceqq_u32(vld1q_u32(tags + i), t);
+        m |= uint64_t(vaddvq_u32(vandq_u32(eq, weights))) << i;
+    }
+    for (; i < n; ++i)
+        m |= uint64_t(tags[i] == tag) << i;
+    return m;
+}
+
+inline uint64_t tag_match_neon(const uint64_t* tags, uint32_t n, uint64_t tag) {
+    const uint64x2_t t = vdupq_n_u64(tag);
+    uint64_t m = 0;
+    uint32_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        uint64x2_t eq = vceqq_u64(vld1q_u64(tags + i), t);
+        m |= ((vgetq_lane_u64(eq, 0) & 1) | (vgetq_lane_u64(eq, 1) & 2)) << i;
+    }
+    for (; i < n; ++i)
+        m |= uint64_t(tags[i] == tag) << i;
+    return m;
+}
+#endif
+
+// Versão com n fixo em tempo de compilação, totalmente desenrolada
+template<uint32_t A>
+inline uint64_t tag_match_fixed(const uint32_t* tags, uint32_t tag) {
+    uint64_t m = 0;
+#if defined(CACHE_SIM_TAG_MATCH_X86) && defined(__AVX2__)
+    if constexpr (A % 8 == 0) {
+        const __m256i t = _mm256_set1_epi32(static_cast<int>(tag));
+        for (uint32_t i = 0; i < A; i += 8) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tags + i));
+            uint32_t eq = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, t)));
+            m |= uint64_t(eq) << i;
+        }
+        return m;
+    }
+#endif
+#if defined(CACHE_SIM_TAG_MATCH_X86) && defined(__SSE2__)
+    if constexpr (A % 4 == 0) {
+        const __m128i t = _mm_set1_epi32(static_cast<int>(tag));
+        for (uint32_t i = 0; i < A; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags + i));
+            uint32_t eq = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, t)));
+            m |= uint64_t(eq) << i;
+        }
+        return m;
+    }
+#endif
+    for (uint32_t i = 0; i < A; ++i)
+        m |= uint64_t(tags[i] == tag) << i;
+    return m;
+}
+
+template<uint32_t A>
+inline uint64_t tag_match_fixed(const uint64_t* tags, uint64_t tag) {
+    uint64_t m = 0;
+#if defined(CACHE_SIM_TAG_MATCH_X86) && defined(__AVX2__)
+    if constexpr (A % 4 == 0) {
+        const __m256i t = _mm256_set1_epi64x(static_cast<long long>(tag));
+        for (uint32_t i = 0; i < A; i += 4) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tags + i));
+            uint32_t eq = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, t)));
+            m |= uint64_t(eq) << i;
+        }
+        return m;
+    }
+#endif
+#if defined(CACHE_SIM_TAG_MATCH_X86) && defined(__SSE4_1__)
+    if constexpr (A % 2 == 0) {
+        const __m128i t = _mm_set1_epi64x(static_cast<long long>(tag));
+        for (uint32_t i = 0; i < A; i += 2) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags + i));
+            uint32_t eq = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, t)));
+            m |= uint64_t(eq) << i;
+        }
+        return m;
+    }
+#endif
+    for (uint32_t i = 0; i < A; ++i)
+        m |= uint64_t(tags[i] == tag) << i;
+    return m;
+}
+
+// Escolhe o kernel pela CPU em execução; conjuntos pequenos ficam no escalar
+template<typename T>
+TagMatchFn<T> select_tag_match(uint32_t assoc);
+
+template<>
+inline TagMatchFn<uint32_t> select_tag_match<uint32_t>(uint32_t assoc) {
+    if (assoc < 4) return tag_match_scalar<uint32_t>;
+#ifdef CACHE_SIM_TAG_MATCH_X86
+    if (assoc >= 8 && __builtin_cpu_supports("avx2")) return tag_match_avx2;
+    if (__builtin_cpu_supports("sse2")) return tag_match_sse2;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    return tag_match_neon;
+#endif
+    return tag_match_scalar<uint32_t>;
+}
+
+template<>
+inline TagMatchFn<uint64_t> select_tag_match<uint64_t>(uint32_t assoc) {
+    if (assoc < 2) return tag_match_scalar<uint64_t>;
+#ifdef CACHE_SIM_TAG_MATCH_X86
+    if (assoc >= 4 && __builtin_cpu_supports("avx2")) return tag_match_avx2;
+    if (__builtin_cpu_supports("sse4.1")) return tag_match_sse41;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    return tag_match_neon;
+#endif
+    return tag_match_scalar<uint64_t>;
+}
+
+// Tabela hash de endereçamento aberto (sondagem linear) sem alocação por
+// elemento; só cresce, sem remoção.
+template<typename K, typename V>
+class FlatMap {
+public:
+    explicit FlatMap(size_t expected = 0) {
+        size_t cap = 16;
+        while (cap < expected * 2) cap *= 2;
+        reset(cap);
+    }
+
+    size_t size() const { return count; }
+
+    V* find(K key) {
+        for (size_t i = slot(key);; i = (i + 1) & mask) {
+            if (!used[i]) return nullptr;
+            if (keys[i] == key) return &vals[i];
+        }
+    }
+
+    // Retorna o valor de key, inserindo value se ausente
+    V* insert(K key, V value, bool& inserted) {
+        if ((count + 1) * 2 > keys.size()) grow();
+        size_t i = slot(key);
+        for (; used[i]; i = (i + 1) & mask) {
+            if (keys[i] == key) {
+                inserted = false;
+                return &vals[i];
+            }
+        }
+        used[i] = 1;
+        keys[i] = key;
+        vals[i] = value;
+        count++;
+        inserted = true;
+        return &vals[i];
+    }
+
+private:
+    size_t slot(K key) const {
+        return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+
+    void reset(size_t cap) {
+        keys.assign(cap, K());
+        vals.assign(cap, V());
+        used.assign(cap, 0);
+        mask = cap - 1;
+        shift = 64 - ilog2(static_cast<uint32_t>(cap));
+        count = 0;
+    }
+
+    void grow() {
+        std::vector<K> old_keys;
+        std::vector<V> old_vals;
+        std::vector<uint8_t> old_used;
+        old_keys.swap(keys);
+        old_vals.swap(vals);
+        old_used.swap(used);
+        reset(old_keys.size() * 2);
+        bool inserted;
+        for (size_t i = 0; i < old_keys.size(); ++i)
+            if (old_used[i]) insert(old_keys[i], old_vals[i], inserted);
+    }
+
+    std::vector<K> keys;
+    std::vector<V> vals;
+    std::vector<uint8_t> used;
+    size_t mask = 0, count = 0;
+    uint32_t shift = 0;
+};
+
+// Conjunto dos blocos já acessados, para contar misses compulsórios.
+// Quando o número de bloco tem até DENSE_BITS bits é um bitmap plano;
+// acima disso, páginas de 2^16 blocos são criadas sob demanda, cada uma
+// começando como vetor ordenado de deslocamentos de 16 bits e virando
+// bitmap de 8 KiB quando o vetor passaria desse tamanho (como no Roaring).
+// O diretório de páginas é um vetor com até 2^DIRECT_BITS entradas e, para
+// números de bloco maiores (endereços de 64 bits), uma FlatMap.
+class BlockSet {
+public:
+    static constexpr uint32_t DENSE_BITS = 27;
+    static constexpr uint32_t PAGE_BITS = 16;
+    static constexpr uint32_t DIRECT_BITS = 16;
+    static constexpr uint32_t ARRAY_MAX = 4096;
+
+    explicit BlockSet(uint32_t block_bits) {
+        if (block_bits <= DENSE_BITS)
+            dense.assign(((uint64_t(1) << block_bits) + 63) / 64, 0);
+        else if (block_bits - PAGE_BITS <= DIRECT_BITS)
+            pages.resize(size_t(1) << (block_bits - PAGE_BITS));
+        else
+            sparse = true;
+    }
+
+    // Pede de antemão a palavra do bloco (só no bitmap denso)
+    void prefetch(uint64_t block) const {
+        if (!dense.empty()) prefetch_lines(&dense[block >> 6], sizeof(uint64_t));
+    }
+
+    // Retorna true se o bloco ainda não estava no conjunto
+    bool insert(uint64_t block) {
+        if (!dense.empty()) {
+            uint64_t bit = uint64_t(1) << (block & 63);
+            uint64_t& w = dense[block >> 6];
+            if (w & bit) return false;
+            w |= bit;
+            return true;
+        }
+        if (sparse) {
+            bool inserted;
+            uint32_t* slot = directory.insert(block >> PAGE_BITS,
+                                              static_cast<uint32_t>(pages.size()), inserted);
+            if (inserted) pages.emplace_back(new Page);
+            return pages[*slot]->insert(static_cast<uint16_t>(block));
+        }
+        std::unique_ptr<Page>& page = pages[block >> PAGE_BITS];
+        if (!page) page.reset(new Page);
+        return page->insert(static_cast<uint16_t>(block));
+    }
+
+private:
+    struct Page {
+        std::vector<uint16_t> array;   // ordenado, enquanto bits estiver vazio
+        std::vector<uint64_t> bits;
+
+        bool insert(uint16_t off) {
+            if (!bits.empty()) {
+                uint64_t bit = uint64_t(1) << (off & 63);
+                uint64_t& w = bits[off >> 6];
+                if (w & bit) return false;
+                w |= bit;
+                return true;
+            }
+            auto it = std::lower_bound(array.begin(), array.end(), off);
+            if (it != array.end() && *it == off) return false;
+            if (array.size() < ARRAY_MAX) {
+                array.insert(it, off);
+                return true;
+            }
+            bits.assign((size_t(1) << PAGE_BITS) / 64, 0);
+            for (uint16_t v : array) bits[v >> 6] |= uint64_t(1) << (v & 63);
+            std::vector<uint16_t>().swap(array);
+            bits[off >> 6] |= uint64_t(1) << (off & 63);
+            return true;
+        }
+    };
+
+    std::vector<uint64_t> dense;
+    std::vector<std::unique_ptr<Page>> pages;
+    bool sparse = false;
+    FlatMap<uint64_t, uint32_t> directory;
+};
+
+// Classificação 3C de livro-texto: um miss é compulsório no primeiro
+// acesso ao bloco, de capacidade se também falharia numa cache totalmente
+// associativa LRU com o mesmo número de linhas, e de conflito caso
+// contrário. A cache sombra guarda, numa tabela hash de sondagem linear, o
+// instante do último acesso de cada bloco, e num bitmap os instantes que
+// ainda são o último acesso de algum bloco. Os blocos presentes são os de
+// instante >= evicted; expulsar o LRU é achar o próximo bit do bitmap a
+// partir de evicted. Sem lista encadeada nem remoções, cada acesso é uma
+// sondagem e dois bits; a sombra roda bloco a bloco depois do motor, o que
+// permite pedir de antemão as entradas dos próximos acessos.
+template<typename Addr = uint32_t>
+class ExactThreeC {
+public:
+    uint64_t compulsory = 0;
+    uint64_t capacity = 0;
+    uint64_t conflict = 0;
+
+    ExactThreeC(uint64_t lines, uint32_t offset)
+        : capacity_lines(static_cast<uint32_t>(std::min<uint64_t>(lines, UINT32_MAX / 8))),
+          offset_bits(offset), seen(8 * sizeof(Addr) - offset) {
+        // Tabela com 4 vezes as linhas e ao menos 2^15 entradas: a
+        // reconstrução vem a cada capacity_lines blocos novos, o que numa
+        // cache pequena seria a cada poucas centenas de acessos
+        size_t cap = 16;
+        while (cap < std::max<size_t>(size_t(1) << 15, static_cast<size_t>(capacity_lines) * 4))
+            cap *= 2;
+        table.assign(cap, Slot{Addr(), EMPTY});
+        mask = cap - 1;
+        for (shift = 64; cap > 1; cap >>= 1) shift--;
+        // Janela de instantes entre renumerações: ao menos 4 vezes as linhas
+        size_t w = size_t(1) << 16;
+        while (w < static_cast<size_t>(capacity_lines) * 4) w *= 2;
+        live.assign(w / 64, 0);
+        block_at.resize(w);
+    }
+
+    // Processa todos os acessos do bloco na ordem; fills e replacements são
+    // as posições (crescentes) dos misses da cache real
+    void classify(const Addr* addrs, size_t n,
+                  const std::vector<uint32_t>& fills, const std::vector<uint32_t>& replacements) {
+        size_t f = 0, r = 0;
+        // Próximo miss da cache real (n quando não há mais)
+        auto next_miss = [&]() -> size_t {
+            size_t a = f < fills.size() ? fills[f] : n;
+            size_t b = r < replacements.size() ? replacements[r] : n;
+            return std::min(a, b);
+        };
+        size_t miss_at = next_miss();
+        for (size_t k = 0; k < n; ++k) {
+            if (k + AHEAD < n) {
+                Addr next = addrs[k + AHEAD] >> offset_bits;
+                prefetch_lines(&table[home(next)], sizeof(Slot));
+                seen.prefetch(next);
+            }
+            Addr b = addrs[k] >> offset_bits;
+            bool shadow_hit = touch(b);
+            if (k != miss_at) continue;
+            if (f < fills.size() && fills[f] == k) f++; else r++;
+            miss_at = next_miss();
+            // Um hit na sombra é de um bloco já visto, sem consultar seen; o
+            // primeiro acesso a um bloco é sempre um miss da cache real
+            if (shadow_hit)
+                conflict++;
+            else if (seen.insert(b))
+                compulsory++;
+            else
+                capacity++;
+        }
+    }
+
+    // Aquecimento: atualiza a cache sombra e os blocos já vistos sem contar
+    void warm(const Addr* addrs, size_t n) {
+        for (size_t k = 0; k < n; ++k) {
+            Addr b = addrs[k] >> offset_bits;
+            if (!touch(b)) seen.insert(b);
+        }
+    }
+
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+    // Distância, em acessos, da entrada da tabela pedida de antemão
+    static constexpr size_t AHEAD = 16;
+
+    struct Slot {
+        Addr block;
+        uint32_t last;   // instante do último acesso; EMPTY: entrada vazia
+    };
+
+    size_t home(Addr b) const {
+        return static_cast<size_t>((static_cast<uint64_t>(b) * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+
+    // Acessa b na cache sombra; retorna true em hit
+    bool touch(Addr b) {
+        size_t i = home(b);
+        while (table[i].last != EMPTY && table[i].block != b) i = (i + 1) & mask;
+        bool hit = false;
+        if (table[i].last == EMPTY) {
+            table[i].block = b;
+            entries++;
+        } else if (table[i].last >= evicted) {
+            live[table[i].last >> 6] &= ~(uint64_t(1) << (table[i].last & 63));
+            hit = true;
+        }
+        table[i].last = now;
+        live[now >> 6] |= uint64_t(1) << (now & 63);
+        block_at[now] = b;
+        now++;
+        if (!hit) {
+            if (resident < capacity_lines)
+                resident++;
+            else
+                evict_lru();
+        }
+        // Blocos expulsos continuam na tabela até ela ou a janela encherem
+        if (now == block_at.size() || entries * 2 > table.size()) rebuild();
+        return hit;
+    }
+
+    void evict_lru() {
+        size_t w = evicted >> 6;
+        uint64_t bits = live[w] & (~uint64_t(0) << (evicted & 63));
+        while (!bits) bits = live[++w];
+        uint32_t t = static_cast<uint32_t>(w * 64 + ctz64(bits));
+        live[w] &= ~(uint64_t(1) << (t & 63));
+        evicted = t + 1;
+    }
+
+    // Renumera os blocos presentes como 0..resident-1, na ordem LRU, e
+    // refaz a tabela só com eles
+    void rebuild() {
+        order.clear();
+        for (size_t w = evicted >> 6; w * 64 < now; ++w) {
+            for (uint64_t bits = live[w]; bits; bits &= bits - 1) {
+                uint32_t t = static_cast<uint32_t>(w * 64 + ctz64(bits));
+                if (t >= evicted) order.push_back(block_at[t]);
+            }
+            live[w] = 0;
+        }
+        for (Slot& s : table) s.last = EMPTY;
+        entries = 0;
+        for (uint32_t t = 0; t < order.size(); ++t) {
+            if (t + AHEAD < order.size()) prefetch_lines(&table[home(order[t + AHEAD])], sizeof(Slot));
+            size_t i = home(order[t]);
+            while (table[i].last != EMPTY) i = (i + 1) & mask;
+            table[i] = Slot{order[t], t};
+            live[t >> 6] |= uint64_t(1) << (t & 63);
+            block_at[t] = order[t];
+            entries++;
+        }
+        now = static_cast<uint32_t>(order.size());
+        evicted = 0;
+    }
+
+    uint32_t capacity_lines;
+    uint32_t offset_bits;
+    std::vector<Slot> table;
+    size_t mask = 0;
+    uint32_t shift = 0;
+    size_t entries = 0;
+    std::vector<uint64_t> live;     // bit t: t é o último acesso de um bloco
+    std::vector<Addr> block_at;     // bloco acessado no instante t
+    std::vector<Addr> order;        // rascunho de rebuild()
+    uint32_t now = 0, evicted = 0, resident = 0;
+    BlockSet seen;
+};
+
+// Gerador baseado em contador: o n-ésimo valor de um fluxo é o
+// finalizador do SplitMix64 aplicado a chave + n * phi, sem outro estado.
+inline uint32_t counter_rng(uint64_t key, uint64_t counter) {
+    uint64_t z = key + counter * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return static_cast<uint32_t>((z ^ (z >> 31)) >> 32);
+}
+
+// Reduz r a [0, n) por multiplicação e deslocamento, sem divisão
+inline uint32_t bounded_rand(uint32_t r, uint32_t n) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(r) * n) >> 32);
+}
+
+}  // namespace detail
+
+// Contadores de uma simulação, separados da Cache para poderem ser
+// somados (shards, janelas) e impressos
+struct CacheStats {
+    uint64_t accesses = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t miss_compulsory = 0;
+    uint64_t miss_capacity = 0;
+    uint64_t miss_conflict = 0;
+    // Só no trace R/W: escritas, escritas com miss, blocos sujos expulsos
+    // e escritas repassadas à memória (write-through e sem alocação)
+    bool rw = false;
+    uint64_t writes = 0;
+    uint64_t write_misses = 0;
+    uint64_t writebacks = 0;
+    uint64_t mem_writes = 0;
+
+    void add(const CacheStats& o) {
+        accesses += o.accesses;
+        hits += o.hits;
+        misses += o.misses;
+        miss_compulsory += o.miss_compulsory;
+        miss_capacity += o.miss_capacity;
+        miss_conflict += o.miss_conflict;
+        rw = rw || o.rw;
+        writes += o.writes;
+        write_misses += o.write_misses;
+        writebacks += o.writebacks;
+        mem_writes += o.mem_writes;
+    }
+
+    void print(bool modo) const {
+        auto r = [](uint64_t n, uint64_t base) -> double {
+            return (base == 0) ? 0.0 : static_cast<double>(n) / base;
+        };
+
+        if (modo) {
+        // Modo compacto (flag = 1)
+        printf("%" PRIu64 " %.4lf %.4lf %.4lf %.4lf %.4lf",
+               accesses, r(hits, accesses), r(misses, accesses),
+               r(miss_compulsory, misses),
+               r(miss_capacity, misses),
+               r(miss_conflict, misses));
+        if (rw)
+            printf(" %" PRIu64 " %.4lf %" PRIu64 " %" PRIu64,
+                   writes, r(write_misses, writes), writebacks, mem_writes);
+        printf("\n");
+        } else {
+        // Modo formatado (flag = 0)
+        printf("==================================================================\n");
+        printf("Total de acessos:            %" PRIu64 "\n", accesses);
+        printf("Taxa de hits:                %.2lf%%\n", 100.0 * r(hits, accesses));
+        printf("Taxa de misses:              %.2lf%%\n", 100.0 * r(misses, accesses));
+        printf("- Misses compulsórios:       %.2lf%%\n", 100.0 * r(miss_compulsory, misses));
+        printf("- Misses por capacidade:     %.2lf%%\n", 100.0 * r(miss_capacity, misses));
+        printf("- Misses por conflito:       %.2lf%%\n", 100.0 * r(miss_conflict, misses));
+        if (rw) {
+        printf("Escritas:                    %" PRIu64 "\n", writes);
+        printf("Taxa de misses de escrita:   %.2lf%%\n", 100.0 * r(write_misses, writes));
+        printf("Write-backs:                 %" PRIu64 "\n", writebacks);
+        printf("Escritas na memória:         %" PRIu64 "\n", mem_writes);
+        }
+        printf("==================================================================\n");
+        }
+    }
+};
+
+namespace detail {
+
+// E/S binária do --checkpoint, na ordem de bytes do host. read_vec exige
+// o tamanho já alocado para a configuração, o que confere a geometria.
+template<typename T>
+void write_pod(FILE* f, const T& v) {
+    if (fwrite(&v, sizeof(T), 1, f) != 1)
+        throw std::runtime_error("Erro ao gravar checkpoint");
+}
+
+template<typename T>
+void write_vec(FILE* f, const std::vector<T>& v) {
+    uint64_t n = v.size();
+    write_pod(f, n);
+    if (n && fwrite(v.data(), sizeof(T), n, f) != n)
+        throw std::runtime_error("Erro ao gravar checkpoint");
+}
+
+template<typename T>
+void read_pod(FILE* f, T& v) {
+    if (fread(&v, sizeof(T), 1, f) != 1)
+        throw std::runtime_error("Erro: checkpoint truncado");
+}
+
+template<typename T>
+void read_vec(FILE* f, std::vector<T>& v) {
+    uint64_t n;
+    read_pod(f, n);
+    if (n != v.size())
+        throw std::runtime_error("Erro: checkpoint incompatível com a configuração");
+    if (n && fread(v.data(), sizeof(T), n, f) != n)
+        throw std::runtime_error("Erro: checkpoint truncado");
+}
+
+// Addr é o tipo dos endereços do trace (e das tags): 32 ou 64 bits
+template<typename Addr = uint32_t>
+class CacheEngine {
+public:
+    uint32_t n_sets, block_size, assoc;
+    Replacement repl;
+    // Geometria, calculada uma vez no construtor
+    uint32_t offset_bits, index_bits, index_mask, tag_shift;
+
+    // Armazenamento plano: a linha (set, way) fica em set * assoc + way
+    std::vector<Addr> tags;
+    // Bits de validade, valid_words palavras de 64 bits por conjunto
+    uint32_t valid_words;
+    std::vector<uint64_t> valid;
+    // LRU: instante do último uso de cada linha; a vítima é a de menor valor
+    std::vector<uint32_t> lru_stamp;
+    uint32_t lru_clock = 0;
+    // FIFO: fila circular de ways por conjunto
+    std::vector<uint32_t> fifo_queue;
+    std::vector<uint32_t> fifo_front, fifo_size;
+    TagMatchFn<Addr> tag_match;
+    // RANDOM: um fluxo por conjunto, identificado pela semente e pelo
+    // índice global do conjunto (j * set_stride + set_first, ou set_global[j]
+    // na amostragem), para que as simulações particionada e amostrada
+    // reproduzam a serial; o estado é só o contador
+    std::vector<uint64_t> rng_counter;
+    uint64_t rng_seed = 0;
+    uint32_t set_stride = 1, set_first = 0;
+    std::vector<uint32_t> set_global;
+    // PLRU: bits por conjunto no mesmo formato de valid (valid_words
+    // palavras). Árvore: nó i (1..assoc-1, em ordem de heap) aponta para a
+    // subárvore da próxima vítima (0 = esquerda). Bit: bit i = way i usada
+    // recentemente.
+    std::vector<uint64_t> plru;
+    // RRIP: RRPV de 2 bits por linha, 32 por palavra (rrpv_words por conjunto)
+    uint32_t rrpv_words = 0;
+    std::vector<uint64_t> rrpv;
+    // DRRIP: conjuntos líderes de SRRIP (i % duel_stride == 0) e BRRIP
+    // (== 1) e contador de seleção saturado em 10 bits
+    uint32_t duel_stride = 0;
+    uint32_t psel = PSEL_MAX / 2;
+    static constexpr uint32_t PSEL_MAX = 1023;
+    static constexpr uint32_t RRPV_MAX = 3;
+
+    // Trace R/W: bits de sujo no mesmo formato de valid e políticas de escrita
+    bool rw = false;
+    bool write_back = true, write_allocate = true;
+    std::vector<uint64_t> dirty;
+
+    uint32_t total_valid_lines = 0;
+    uint64_t accesses = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t miss_compulsory = 0;
+    uint64_t miss_capacity = 0;
+    uint64_t miss_conflict = 0;
+    uint64_t writes = 0;
+    uint64_t write_misses = 0;
+    uint64_t writebacks = 0;
+    uint64_t mem_writes = 0;
+
+    CacheEngine(uint32_t ns, uint32_t bs, uint32_t a, Replacement r)
+        : n_sets(ns), block_size(bs), assoc(a), repl(r) {
+        if (!is_pow2(ns))
+            throw std::invalid_argument("nsets deve ser potência de 2: " + std::to_string(ns));
+        if (!is_pow2(bs))
+            throw std::invalid_argument("bsize deve ser potência de 2: " + std::to_string(bs));
+        if (a == 0)
+            throw std::invalid_argument("assoc deve ser maior que zero");
+        offset_bits = ilog2(bs);
+        index_bits = ilog2(ns);
+        index_mask = ns - 1;
+        tag_shift = offset_bits + index_bits;
+        if (tag_shift >= 8 * sizeof(Addr))
+            throw std::invalid_argument("nsets * bsize excede o espaço de endereçamento " +
+                                   std::to_string(8 * sizeof(Addr)) + "-bit");
+
+        size_t lines = static_cast<size_t>(ns) * a;
+        tags.assign(lines, 0);
+        valid_words = (a + 63) / 64;
+        valid.assign(static_cast<size_t>(ns) * valid_words, 0);
+        tag_match = select_tag_match<Addr>(a);
+        batch_fn = select_batch_fn<false>(r, a);
+        logged_fn = select_batch_fn<true>(r, a);
+        rw_fn = select_batch_fn<false, true>(r, a);
+        warm_fn = select_batch_fn<false, false, false>(r, a);
+        warm_rw_fn = select_batch_fn<false, true, false>(r, a);
+        if (r == Replacement::LRU) {
+            lru_stamp.assign(lines, 0);
+        } else if (r == Replacement::FIFO) {
+            fifo_queue.assign(lines, 0);
+            fifo_front.assign(ns, 0);
+            fifo_size.assign(ns, 0);
+        } else if (r == Replacement::RANDOM) {
+            rng_counter.assign(ns, 0);
+        } else if (r == Replacement::SRRIP || r == Replacement::BRRIP || r == Replacement::DRRIP) {
+            rrpv_words = (a + 31) / 32;
+            rrpv.assign(static_cast<size_t>(ns) * rrpv_words, 0);
+            rng_counter.assign(ns, 0);
+            duel_stride = ns >= 64 ? ns / 32 : 2;
+        } else {
+            if (r == Replacement::PLRU_TREE && !is_pow2(a))
+                throw std::invalid_argument("PLRU em árvore exige assoc potência de 2: " +
+                                            std::to_string(a));
+            plru.assign(valid.size(), 0);
+        }
+    }
+
+    // Passa a aceitar access_batch_rw com a política de escrita dada
+    void enable_rw(bool wb, bool wa) {
+        rw = true;
+        write_back = wb;
+        write_allocate = wa;
+        dirty.assign(valid.size(), 0);
+    }
+
+    inline bool is_dirty(uint32_t set, uint32_t way) const {
+        return (dirty[static_cast<size_t>(set) * valid_words + (way >> 6)] >> (way & 63)) & 1;
+    }
+
+    inline void set_dirty(uint32_t set, uint32_t way, bool d) {
+        uint64_t& w = dirty[static_cast<size_t>(set) * valid_words + (way >> 6)];
+        uint64_t bit = uint64_t(1) << (way & 63);
+        w = d ? (w | bit) : (w & ~bit);
+    }
+
+    // O conjunto local j corresponde ao conjunto global j * stride + first
+    void seed_random(uint64_t seed, uint32_t stride = 1, uint32_t first = 0) {
+        rng_seed = seed;
+        set_stride = stride;
+        set_first = first;
+        set_global.clear();
+        std::fill(rng_counter.begin(), rng_counter.end(), 0);
+    }
+
+    // O conjunto local j corresponde ao conjunto global global_sets[j]
+    void seed_random(uint64_t seed, std::vector<uint32_t> global_sets) {
+        if (global_sets.size() != n_sets)
+            throw std::invalid_argument("seed_random espera um índice global por conjunto");
+        seed_random(seed);
+        set_global = std::move(global_sets);
+    }
+
+    // Estado completo para --checkpoint: linhas, metadados da política,
+    // fluxos RANDOM e contadores. A geometria, a política e a política de
+    // escrita são gravadas para conferência em load().
+    void save(FILE* f) const {
+        const uint32_t geom[] = {n_sets, block_size, assoc, static_cast<uint32_t>(repl),
+                                 rw, write_back, write_allocate};
+        write_pod(f, geom);
+        write_pod(f, rng_seed);
+        write_pod(f, set_stride);
+        write_pod(f, set_first);
+        write_vec(f, tags);
+        write_vec(f, valid);
+        write_vec(f, lru_stamp);
+        write_pod(f, lru_clock);
+        write_vec(f, fifo_queue);
+        write_vec(f, fifo_front);
+        write_vec(f, fifo_size);
+        write_vec(f, rng_counter);
+        write_vec(f, plru);
+        write_vec(f, rrpv);
+        write_pod(f, psel);
+        write_vec(f, dirty);
+        const uint64_t counters[] = {total_valid_lines, accesses, hits, misses, miss_compulsory,
+                                     miss_capacity, miss_conflict, writes, write_misses,
+                                     writebacks, mem_writes};
+        write_pod(f, counters);
+    }
+
+    void load(FILE* f) {
+        uint32_t geom[7];
+        read_pod(f, geom);
+        const uint32_t expect[] = {n_sets, block_size, assoc, static_cast<uint32_t>(repl),
+                                   rw, write_back, write_allocate};
+        if (memcmp(geom, expect, sizeof(geom)) != 0)
+            throw std::runtime_error("Erro: checkpoint incompatível com a configuração");
+        read_pod(f, rng_seed);
+        read_pod(f, set_stride);
+        read_pod(f, set_first);
+        read_vec(f, tags);
+        read_vec(f, valid);
+        read_vec(f, lru_stamp);
+        read_pod(f, lru_clock);
+        read_vec(f, fifo_queue);
+        read_vec(f, fifo_front);
+        read_vec(f, fifo_size);
+        read_vec(f, rng_counter);
+        read_vec(f, plru);
+        read_vec(f, rrpv);
+        read_pod(f, psel);
+        read_vec(f, dirty);
+        uint64_t counters[11];
+        read_pod(f, counters);
+        total_valid_lines = static_cast<uint32_t>(counters[0]);
+        accesses = counters[1];
+        hits = counters[2];
+        misses = counters[3];
+        miss_compulsory = counters[4];
+        miss_capacity = counters[5];
+        miss_conflict = counters[6];
+        writes = counters[7];
+        write_misses = counters[8];
+        writebacks = counters[9];
+        mem_writes = counters[10];
+    }
+
+    inline uint32_t random_way(uint32_t set, uint32_t n) {
+        uint64_t global = set_global.empty() ? static_cast<uint64_t>(set) * set_stride + set_first
+                                             : set_global[set];
+        uint32_t r = counter_rng(rng_seed ^ (global * 0xD1B54A32D192ED03ull), rng_counter[set]++);
+        return bounded_rand(r, n);
+    }
+
+    inline void decode(Addr address, uint32_t& index, Addr& tag) const {
+        index = static_cast<uint32_t>(address >> offset_bits) & index_mask;
+        tag = address >> tag_shift;
+    }
+
+    // Nas funções abaixo A é a associatividade conhecida em tempo de
+    // compilação; A = 0 usa o valor de assoc em tempo de execução.
+    template<uint32_t A = 0>
+    inline uint32_t ways() const {
+        return A ? A : assoc;
+    }
+
+    // Resultado da sondagem de um conjunto: way com a tag (hit) e primeira
+    // way inválida, -1 quando não existem
+    struct Probe {
+        int32_t hit;
+        int32_t free;
+    };
+
+    template<uint32_t A = 0>
+    inline Probe probe(uint32_t set, Addr tag) const {
+        const Addr* row = &tags[static_cast<size_t>(set) * ways<A>()];
+        Probe p{-1, -1};
+        if constexpr (A != 0 && A <= 64) {
+            uint64_t vw = valid[set];
+            uint64_t m = tag_match_fixed<A>(row, tag) & vw;
+            constexpr uint64_t lanes = (A == 64) ? ~uint64_t(0) : ((uint64_t(1) << A) - 1);
+            uint64_t inv = ~vw & lanes;
+            if (m)
+                p.hit = static_cast<int32_t>(ctz64(m));
+            else if (inv)
+                p.free = static_cast<int32_t>(ctz64(inv));
+            return p;
+        }
+        const uint64_t* vw = &valid[static_cast<size_t>(set) * valid_words];
+        for (uint32_t w = 0; w < valid_words; ++w) {
+            uint32_t base = w * 64;
+            uint32_t n = std::min(64u, assoc - base);
+            uint64_t m = tag_match(row + base, n, tag) & vw[w];
+            if (m) {
+                p.hit = static_cast<int32_t>(base + ctz64(m));
+                return p;
+            }
+            uint64_t lanes = (n == 64) ? ~uint64_t(0) : ((uint64_t(1) << n) - 1);
+            uint64_t inv = ~vw[w] & lanes;
+            if (p.free < 0 && inv)
+                p.free = static_cast<int32_t>(base + ctz64(inv));
+        }
+        return p;
+    }
+
+    inline void set_valid(uint32_t set, uint32_t way) {
+        valid[static_cast<size_t>(set) * valid_words + (way >> 6)] |= uint64_t(1) << (way & 63);
+    }
+
+    template<uint32_t A = 0>
+    inline void touch_lru(uint32_t set, uint32_t way) {
+        if (lru_clock == UINT32_MAX) renormalize_lru();
+        lru_stamp[static_cast<size_t>(set) * ways<A>() + way] = ++lru_clock;
+    }
+
+    template<uint32_t A = 0>
+    inline uint32_t lru_victim(uint32_t set) const {
+        const uint32_t n = ways<A>();
+        const uint32_t* st = &lru_stamp[static_cast<size_t>(set) * n];
+        uint32_t victim = 0;
+        for (uint32_t i = 1; i < n; ++i)
+            if (st[i] < st[victim]) victim = i;
+        return victim;
+    }
+
+    // Chamado quando o relógio de 32 bits esgota: reenumera as idades de
+    // cada conjunto como 1..assoc preservando a ordem relativa.
+    void renormalize_lru() {
+        std::vector<uint32_t> order(assoc);
+        for (uint32_t set = 0; set < n_sets; ++set) {
+            uint32_t* st = &lru_stamp[static_cast<size_t>(set) * assoc];
+            for (uint32_t i = 0; i < assoc; ++i) order[i] = i;
+            std::sort(order.begin(), order.end(),
+                 [st](uint32_t x, uint32_t y) { return st[x] < st[y]; });
+            for (uint32_t i = 0; i < assoc; ++i) st[order[i]] = i + 1;
+        }
+        lru_clock = assoc;
+    }
+
+    template<uint32_t A = 0>
+    inline void enqueue_fifo(uint32_t set, uint32_t way) {
+        const uint32_t n = ways<A>();
+        size_t row = static_cast<size_t>(set) * n;
+        fifo_queue[row + (fifo_front[set] + fifo_size[set]) % n] = way;
+        fifo_size[set]++;
+    }
+
+    template<uint32_t A = 0>
+    inline uint32_t dequeue_fifo(uint32_t set) {
+        const uint32_t n = ways<A>();
+        size_t row = static_cast<size_t>(set) * n;
+        uint32_t victim = fifo_queue[row + fifo_front[set]];
+        fifo_front[set] = (fifo_front[set] + 1) % n;
+        fifo_size[set]--;
+        return victim;
+    }
+
+    template<uint32_t A = 0>
+    inline void plru_tree_touch(uint32_t set, uint32_t way) {
+        const uint32_t n = ways<A>();
+        uint64_t* w = &plru[static_cast<size_t>(set) * valid_words];
+        uint32_t node = 1;
+        for (uint32_t level = ilog2(n); level-- > 0;) {
+            uint32_t dir = (way >> level) & 1;
+            uint64_t bit = uint64_t(1) << (node & 63);
+            // Aponta para o lado oposto ao da way acessada
+            if (dir)
+                w[node >> 6] &= ~bit;
+            else
+                w[node >> 6] |= bit;
+            node = node * 2 + dir;
+        }
+    }
+
+    template<uint32_t A = 0>
+    inline uint32_t plru_tree_victim(uint32_t set) const {
+        const uint32_t n = ways<A>();
+        const uint64_t* w = &plru[static_cast<size_t>(set) * valid_words];
+        uint32_t node = 1;
+        while (node < n)
+            node = node * 2 + static_cast<uint32_t>((w[node >> 6] >> (node & 63)) & 1);
+        return node - n;
+    }
+
+    // Máscara das ways existentes na palavra w de um conjunto com n ways
+    static inline uint64_t way_lanes(uint32_t n, uint32_t w) {
+        uint32_t left = n - w * 64;
+        return left >= 64 ? ~uint64_t(0) : ((uint64_t(1) << left) - 1);
+    }
+
+    template<uint32_t A = 0>
+    inline void plru_bit_touch(uint32_t set, uint32_t way) {
+        const uint32_t n = ways<A>();
+        const uint32_t nw = A ? (A + 63) / 64 : valid_words;
+        uint64_t* w = &plru[static_cast<size_t>(set) * nw];
+        w[way >> 6] |= uint64_t(1) << (way & 63);
+        // Quando todas ficam marcadas, só a acessada permanece
+        for (uint32_t i = 0; i < nw; ++i)
+            if (w[i] != way_lanes(n, i)) return;
+        for (uint32_t i = 0; i < nw; ++i) w[i] = 0;
+        w[way >> 6] = uint64_t(1) << (way & 63);
+    }
+
+    template<uint32_t A = 0>
+    inline uint32_t plru_bit_victim(uint32_t set) const {
+        const uint32_t n = ways<A>();
+        const uint32_t nw = A ? (A + 63) / 64 : valid_words;
+        const uint64_t* w = &plru[static_cast<size_t>(set) * nw];
+        for (uint32_t i = 0; i < nw; ++i) {
+            uint64_t clear = ~w[i] & way_lanes(n, i);
+            if (clear) return i * 64 + ctz64(clear);
+        }
+        return 0;
+    }
+
+    // Bits pares das lanes de RRPV existentes na palavra w
+    static inline uint64_t rrpv_lanes(uint32_t n, uint32_t w) {
+        uint32_t left = n - w * 32;
+        uint64_t m = left >= 32 ? ~uint64_t(0) : ((uint64_t(1) << (2 * left)) - 1);
+        return m & 0x5555555555555555ull;
+    }
+
+    template<uint32_t A = 0>
+    inline void set_rrpv(uint32_t set, uint32_t way, uint32_t v) {
+        const uint32_t nw = A ? (A + 31) / 32 : rrpv_words;
+        uint64_t& w = rrpv[static_cast<size_t>(set) * nw + (way >> 5)];
+        uint32_t shift = (way & 31) * 2;
+        w = (w & ~(uint64_t(3) << shift)) | (uint64_t(v) << shift);
+    }
+
+    // Primeira way com RRPV máximo; se não houver, envelhece todas as
+    // linhas do conjunto (nenhuma está em 3, então não há vai-um entre lanes)
+    template<uint32_t A = 0>
+    inline uint32_t rrip_victim(uint32_t set) {
+        const uint32_t n = ways<A>();
+        const uint32_t nw = A ? (A + 31) / 32 : rrpv_words;
+        uint64_t* w = &rrpv[static_cast<size_t>(set) * nw];
+        for (;;) {
+            for (uint32_t i = 0; i < nw; ++i) {
+                uint64_t at_max = w[i] & (w[i] >> 1) & rrpv_lanes(n, i);
+                if (at_max) return i * 32 + ctz64(at_max) / 2;
+            }
+            for (uint32_t i = 0; i < nw; ++i) w[i] += rrpv_lanes(n, i);
+        }
+    }
+
+    // BRRIP insere com RRPV distante, e com 1/32 de chance com RRPV longo
+    inline uint32_t brrip_insertion(uint32_t set) {
+        return random_way(set, 32) == 0 ? RRPV_MAX - 1 : RRPV_MAX;
+    }
+
+    template<uint32_t A = 0>
+    inline void drrip_insert(uint32_t set, uint32_t way) {
+        uint32_t role = set % duel_stride;
+        bool brrip;
+        if (role == 0) {
+            if (psel < PSEL_MAX) psel++;
+            brrip = false;
+        } else if (role == 1) {
+            if (psel > 0) psel--;
+            brrip = true;
+        } else {
+            brrip = psel > PSEL_MAX / 2;
+        }
+        set_rrpv<A>(set, way, brrip ? brrip_insertion(set) : RRPV_MAX - 1);
+    }
+
+    // Distância (em acessos) do prefetch de conjuntos no motor; 0 desliga
+    uint32_t prefetch_distance = 0;
+
+    // Pede as linhas das tags, da validade e do estado da política do conjunto
+    template<Replacement R, uint32_t A>
+    inline void prefetch_set(uint32_t set) const {
+        const uint32_t n = ways<A>();
+        size_t row = static_cast<size_t>(set) * n;
+        prefetch_lines(&tags[row], n * sizeof(Addr));
+        prefetch_lines(&valid[static_cast<size_t>(set) * valid_words], 1);
+        if constexpr (R == Replacement::LRU) {
+            prefetch_lines(&lru_stamp[row], n * sizeof(uint32_t));
+        } else if constexpr (R == Replacement::FIFO) {
+            prefetch_lines(&fifo_queue[row], n * sizeof(uint32_t));
+            prefetch_lines(&fifo_front[set], 1);
+            prefetch_lines(&fifo_size[set], 1);
+        } else if constexpr (R == Replacement::RANDOM) {
+            prefetch_lines(&rng_counter[set], 1);
+        } else if constexpr (R == Replacement::PLRU_TREE || R == Replacement::PLRU_BIT) {
+            prefetch_lines(&plru[static_cast<size_t>(set) * valid_words], 1);
+        } else {
+            prefetch_lines(&rrpv[static_cast<size_t>(set) * rrpv_words], 1);
+            if constexpr (R != Replacement::SRRIP) prefetch_lines(&rng_counter[set], 1);
+        }
+    }
+
+    // Ganchos de política do motor: acesso com hit, inserção de um bloco
+    // (compulsória ou substituição) e escolha da vítima num conjunto cheio
+    template<Replacement R, uint32_t A>
+    inline void policy_touch(uint32_t set, uint32_t way) {
+        if constexpr (R == Replacement::LRU)
+            touch_lru<A>(set, way);
+        else if constexpr (R == Replacement::PLRU_TREE)
+            plru_tree_touch<A>(set, way);
+        else if constexpr (R == Replacement::PLRU_BIT)
+            plru_bit_touch<A>(set, way);
+        else if constexpr (R == Replacement::SRRIP || R == Replacement::BRRIP ||
+                           R == Replacement::DRRIP)
+            set_rrpv<A>(set, way, 0);
+    }
+
+    template<Replacement R, uint32_t A>
+    inline void policy_insert(uint32_t set, uint32_t way) {
+        if constexpr (R == Replacement::FIFO)
+            enqueue_fifo<A>(set, way);
+        else if constexpr (R == Replacement::SRRIP)
+            set_rrpv<A>(set, way, RRPV_MAX - 1);
+        else if constexpr (R == Replacement::BRRIP)
+            set_rrpv<A>(set, way, brrip_insertion(set));
+        else if constexpr (R == Replacement::DRRIP)
+            drrip_insert<A>(set, way);
+        else
+            policy_touch<R, A>(set, way);
+    }
+
+    template<Replacement R, uint32_t A>
+    inline uint32_t policy_victim(uint32_t set) {
+        if constexpr (R == Replacement::RANDOM)
+            return random_way(set, ways<A>());
+        else if constexpr (R == Replacement::LRU)
+            return lru_victim<A>(set);
+        else if constexpr (R == Replacement::FIFO)
+            return dequeue_fifo<A>(set);
+        else if constexpr (R == Replacement::PLRU_TREE)
+            return plru_tree_victim<A>(set);
+        else if constexpr (R == Replacement::PLRU_BIT)
+            return plru_bit_victim<A>(set);
+        else
+            return rrip_victim<A>(set);
+    }
+
+    void access(Addr address) {
+        access_batch(&address, 1);
+    }
+
+    // Classificador 3C exato opcional; quando ativo substitui a divisão
+    // compulsório/capacidade/conflito em stats()
+    std::unique_ptr<ExactThreeC<Addr>> exact_3c;
+
+    void enable_exact_3c() {
+        exact_3c.reset(new ExactThreeC<Addr>(static_cast<uint64_t>(n_sets) * assoc, offset_bits));
+    }
+
+    // Processa um bloco contíguo de endereços pela instanciação escolhida
+    // no construtor.
+    void access_batch(const Addr* addrs, size_t n) {
+        if (exact_3c) {
+            access_batch_logged(addrs, n);
+            classify_logged(addrs, n);
+            return;
+        }
+        (this->*batch_fn)(addrs, nullptr, n);
+    }
+
+    // Bloco de um trace R/W: ops[k] é o tipo de operação de addrs[k]
+    void access_batch_rw(const Addr* addrs, const uint8_t* ops, size_t n) {
+        (this->*rw_fn)(addrs, ops, n);
+    }
+
+    // Acessos repetidos ao bloco do acesso anterior, descartados antes do
+    // motor por RunFilter: são hits que não alteram o estado
+    void count_repeat_hits(uint64_t n) {
+        accesses += n;
+        hits += n;
+    }
+
+    // Aquecimento (--warmup): atualiza o estado como access_batch ou
+    // access_batch_rw, pelas instanciações que não tocam os contadores
+    void warm_batch(const Addr* addrs, const uint8_t* ops, size_t n) {
+        if (exact_3c) exact_3c->warm(addrs, n);
+        (this->*(rw ? warm_rw_fn : warm_fn))(addrs, ops, n);
+    }
+
+    // Como access_batch, mas em vez de classificar as substituições em
+    // capacidade/conflito registra em log_fills e log_replacements as
+    // posições (no bloco) dos preenchimentos compulsórios e das substituições,
+    // e em log_victims o endereço do bloco expulso por cada substituição.
+    std::vector<uint32_t> log_fills, log_replacements;
+    std::vector<Addr> log_victims;
+
+    void access_batch_logged(const Addr* addrs, size_t n) {
+        log_fills.clear();
+        log_replacements.clear();
+        log_victims.clear();
+        (this->*logged_fn)(addrs, nullptr, n);
+    }
+
+    // Completa a classificação das substituições do último
+    // access_batch_logged como o motor sem log faria (ou pela 3C exata)
+    void classify_logged(const Addr* addrs, size_t n) {
+        if (exact_3c) {
+            exact_3c->classify(addrs, n, log_fills, log_replacements);
+            return;
+        }
+        uint64_t total_lines = static_cast<uint64_t>(n_sets) * assoc;
+        uint64_t need = total_lines - (total_valid_lines - log_fills.size());
+        int64_t full_at = INT64_MAX;
+        if (need == 0)
+            full_at = -1;
+        else if (log_fills.size() >= need)
+            full_at = log_fills[need - 1];
+        for (uint32_t k : log_replacements) {
+            if (static_cast<int64_t>(k) > full_at)
+                miss_capacity++;
+            else
+                miss_conflict++;
+        }
+    }
+
+    // Endereço do bloco guardado na linha (set, way)
+    inline Addr block_address(uint32_t set, uint32_t way) const {
+        return (tags[static_cast<size_t>(set) * assoc + way] << tag_shift) |
+               (static_cast<Addr>(set) << offset_bits);
+    }
+
+    template<Replacement R>
+    using Policy = std::integral_constant<Replacement, R>;
+
+    // Chama f com a política da cache como constante de compilação
+    template<typename F>
+    auto with_policy(F&& f) {
+        switch (repl) {
+            case Replacement::LRU: return f(Policy<Replacement::LRU>());
+            case Replacement::FIFO: return f(Policy<Replacement::FIFO>());
+            case Replacement::PLRU_TREE: return f(Policy<Replacement::PLRU_TREE>());
+            case Replacement::PLRU_BIT: return f(Policy<Replacement::PLRU_BIT>());
+            case Replacement::SRRIP: return f(Policy<Replacement::SRRIP>());
+            case Replacement::BRRIP: return f(Policy<Replacement::BRRIP>());
+            case Replacement::DRRIP: return f(Policy<Replacement::DRRIP>());
+            case Replacement::RANDOM: break;
+        }
+        return f(Policy<Replacement::RANDOM>());
+    }
+
+    // Operações isoladas usadas pela hierarquia. lookup conta o acesso e,
+    // no hit, atualiza a política ou (remove = true) retira o bloco; no miss
+    // nada é preenchido e a classificação é a do motor.
+    bool lookup(Addr address, bool remove) {
+        uint32_t index;
+        Addr tag;
+        decode(address, index, tag);
+        Probe p = probe(index, tag);
+        accesses++;
+        if (p.hit >= 0) {
+            hits++;
+            if (remove)
+                invalidate_line(index, p.hit);
+            else
+                with_policy([&](auto r) { policy_touch<decltype(r)::value, 0>(index, p.hit); });
+            return true;
+        }
+        misses++;
+        if (p.free >= 0)
+            miss_compulsory++;
+        else if (total_valid_lines == static_cast<uint64_t>(n_sets) * assoc)
+            miss_capacity++;
+        else
+            miss_conflict++;
+        return false;
+    }
+
+    // Preenche um bloco ausente sem contar acesso; retorna true e o
+    // endereço do bloco expulso em evicted quando há substituição
+    bool install(Addr address, Addr& evicted) {
+        uint32_t index;
+        Addr tag;
+        decode(address, index, tag);
+        Probe p = probe(index, tag);
+        if (p.hit >= 0) return false;
+        return with_policy([&](auto r) {
+            constexpr Replacement R = decltype(r)::value;
+            size_t row = static_cast<size_t>(index) * assoc;
+            if (p.free >= 0) {
+                uint32_t i = static_cast<uint32_t>(p.free);
+                set_valid(index, i);
+                tags[row + i] = tag;
+                policy_insert<R, 0>(index, i);
+                total_valid_lines++;
+                return false;
+            }
+            uint32_t v = policy_victim<R, 0>(index);
+            evicted = block_address(index, v);
+            tags[row + v] = tag;
+            policy_insert<R, 0>(index, v);
+            return true;
+        });
+    }
+
+    bool invalidate(Addr address) {
+        uint32_t index;
+        Addr tag;
+        decode(address, index, tag);
+        Probe p = probe(index, tag);
+        if (p.hit < 0) return false;
+        invalidate_line(index, p.hit);
+        return true;
+    }
+
+    void invalidate_line(uint32_t set, uint32_t way) {
+        valid[static_cast<size_t>(set) * valid_words + (way >> 6)] &= ~(uint64_t(1) << (way & 63));
+        total_valid_lines--;
+        if (repl != Replacement::FIFO) return;
+        // A fila contém exatamente as ways válidas: retira a way mantendo a ordem
+        size_t row = static_cast<size_t>(set) * assoc;
+        uint32_t front = fifo_front[set], n = fifo_size[set], j = 0;
+        while (fifo_queue[row + (front + j) % assoc] != way) j++;
+        for (; j + 1 < n; ++j)
+            fifo_queue[row + (front + j) % assoc] = fifo_queue[row + (front + j + 1) % assoc];
+        fifo_size[set]--;
+    }
+
+    // Motor especializado por política e associatividade: os contadores
+    // ficam em variáveis locais e são somados aos membros uma vez por bloco
+    // (sem Count, o aquecimento, não são somados).
+    // Com RW, ops traz o tipo de cada acesso e as linhas têm bit de sujo.
+    template<Replacement R, uint32_t A, bool Log, bool RW, bool Count = true>
+    void run_batch(const Addr* addrs, const uint8_t* ops, size_t n) {
+        const uint32_t nways = ways<A>();
+        uint64_t total_lines = static_cast<uint64_t>(n_sets) * nways;
+
+        uint64_t n_hits = 0, n_compulsory = 0, n_capacity = 0, n_conflict = 0;
+        uint64_t n_writes = 0, n_write_misses = 0, n_writebacks = 0, n_mem_writes = 0;
+        uint32_t valid_lines = total_valid_lines;
+
+        // Com prefetch, pede as linhas do conjunto do acesso k + ahead antes
+        // de simular o acesso k (nos últimos ahead acessos do bloco não há)
+        const size_t ahead = prefetch_distance;
+        const size_t prefetch_end = (ahead > 0 && n > ahead) ? n - ahead : 0;
+
+        for (size_t k = 0; k < n; ++k) {
+            if (k < prefetch_end)
+                prefetch_set<R, A>(static_cast<uint32_t>(addrs[k + ahead] >> offset_bits) & index_mask);
+
+            uint32_t index;
+            Addr tag;
+            decode(addrs[k], index, tag);
+            Probe p = probe<A>(index, tag);
+            bool is_write = false;
+            if constexpr (RW) {
+                is_write = ops[k] == OP_WRITE;
+                n_writes += is_write;
+            }
+
+            // HIT
+            if (p.hit >= 0) {
+                policy_touch<R, A>(index, p.hit);
+                n_hits++;
+                if constexpr (RW) {
+                    if (is_write) {
+                        if (write_back)
+                            set_dirty(index, p.hit, true);
+                        else
+                            n_mem_writes++;
+                    }
+                }
+                continue;
+            }
+
+            if constexpr (RW) {
+                if (is_write) {
+                    n_write_misses++;
+                    if (!write_back || !write_allocate) n_mem_writes++;
+                    // Sem alocação a escrita vai direto à memória: conta o
+                    // miss com a classificação de sempre e não preenche
+                    if (!write_allocate) {
+                        if (p.free >= 0)
+                            n_compulsory++;
+                        else if (valid_lines == total_lines)
+                            n_capacity++;
+                        else
+                            n_conflict++;
+                        continue;
+                    }
+                }
+            }
+
+            // Compulsório
+            if (p.free >= 0) {
+                uint32_t i = static_cast<uint32_t>(p.free);
+                set_valid(index, i);
+                tags[static_cast<size_t>(index) * nways + i] = tag;
+                policy_insert<R, A>(index, i);
+                if constexpr (RW)
+                    set_dirty(index, i, is_write && write_back);
+
+                if constexpr (Log)
+                    log_fills.push_back(static_cast<uint32_t>(k));
+                n_compulsory++;
+                valid_lines++;
+                continue;
+            }
+
+            // Substituição
+            uint32_t victim_index = policy_victim<R, A>(index);
+            Addr& line = tags[static_cast<size_t>(index) * nways + victim_index];
+            if constexpr (Log)
+                log_victims.push_back((line << tag_shift) | (static_cast<Addr>(index) << offset_bits));
+            line = tag;
+            policy_insert<R, A>(index, victim_index);
+            if constexpr (RW) {
+                n_writebacks += is_dirty(index, victim_index);
+                set_dirty(index, victim_index, is_write && write_back);
+            }
+
+            if constexpr (Log) {
+                log_replacements.push_back(static_cast<uint32_t>(k));
+            } else if (valid_lines == total_lines) {
+                n_capacity++;
+            } else {
+                n_conflict++;
+            }
+        }
+
+        total_valid_lines = valid_lines;
+        if constexpr (Count) {
+            uint64_t n_misses = n - n_hits;
+            accesses += n;
+            hits += n_hits;
+            misses += n_misses;
+            miss_compulsory += n_compulsory;
+            miss_capacity += n_capacity;
+            miss_conflict += n_conflict;
+            if constexpr (RW) {
+                writes += n_writes;
+                write_misses += n_write_misses;
+                writebacks += n_writebacks;
+                mem_writes += n_mem_writes;
+            }
+        }
+    }
+
+    typedef void (CacheEngine::*BatchFn)(const Addr*, const uint8_t*, size_t);
+    BatchFn batch_fn, logged_fn, rw_fn, warm_fn, warm_rw_fn;
+
+    template<Replacement R, bool Log, bool RW, bool Count>
+    static BatchFn select_batch_fn(uint32_t a) {
+        switch (a) {
+            case 1: return &CacheEngine::template run_batch<R, 1, Log, RW, Count>;
+            case 2: return &CacheEngine::template run_batch<R, 2, Log, RW, Count>;
+            case 4: return &CacheEngine::template run_batch<R, 4, Log, RW, Count>;
+            case 8: return &CacheEngine::template run_batch<R, 8, Log, RW, Count>;
+            case 16: return &CacheEngine::template run_batch<R, 16, Log, RW, Count>;
+            default: return &CacheEngine::template run_batch<R, 0, Log, RW, Count>;
+        }
+    }
+
+    template<bool Log, bool RW = false, bool Count = true>
+    static BatchFn select_batch_fn(Replacement r, uint32_t a) {
+        switch (r) {
+            case Replacement::LRU: return select_batch_fn<Replacement::LRU, Log, RW, Count>(a);
+            case Replacement::FIFO: return select_batch_fn<Replacement::FIFO, Log, RW, Count>(a);
+            case Replacement::PLRU_TREE: return select_batch_fn<Replacement::PLRU_TREE, Log, RW, Count>(a);
+            case Replacement::PLRU_BIT: return select_batch_fn<Replacement::PLRU_BIT, Log, RW, Count>(a);
+            case Replacement::SRRIP: return select_batch_fn<Replacement::SRRIP, Log, RW, Count>(a);
+            case Replacement::BRRIP: return select_batch_fn<Replacement::BRRIP, Log, RW, Count>(a);
+            case Replacement::DRRIP: return select_batch_fn<Replacement::DRRIP, Log, RW, Count>(a);
+            case Replacement::RANDOM: break;
+        }
+        return select_batch_fn<Replacement::RANDOM, Log, RW, Count>(a);
+    }
+
+    CacheStats stats() const {
+        CacheStats st;
+        st.accesses = accesses;
+        st.hits = hits;
+        st.misses = misses;
+        st.miss_compulsory = miss_compulsory;
+        st.miss_capacity = miss_capacity;
+        st.miss_conflict = miss_conflict;
+        st.rw = rw;
+        st.writes = writes;
+        st.write_misses = write_misses;
+        st.writebacks = writebacks;
+        st.mem_writes = mem_writes;
+        if (exact_3c) {
+            st.miss_compulsory = exact_3c->compulsory;
+            st.miss_capacity = exact_3c->capacity;
+            st.miss_conflict = exact_3c->conflict;
+        }
+        return st;
+    }
+
+    void print_stats(bool modo) const {
+        stats().print(modo);
+    }
+};
+
+}  // namespace detail
+
+// Fachada estável sobre o motor; Addr é o tipo dos endereços (32 ou 64 bits)
+template<typename Addr = uint32_t>
+class Cache {
+public:
+    Cache(uint32_t ns, uint32_t bs, uint32_t a, Replacement r) : engine(ns, bs, a, r) {}
+
+    void seed_random(uint64_t seed) { engine.seed_random(seed); }
+    void access(Addr addr) { engine.access(addr); }
+    void access_batch(const Addr* addrs, size_t n) { engine.access_batch(addrs, n); }
+    CacheStats stats() const { return engine.stats(); }
+    void save(FILE* f) const { engine.save(f); }
+    void load(FILE* f) { engine.load(f); }
+
+private:
+    detail::CacheEngine<Addr> engine;
+};
+
+}  // namespace cache_sim
+
+#endif
@@ -0,0 +1,141 @@
+// Anel de memória compartilhada do modo --serve: o protocolo (ShmRingHeader)
+// e o lado do tracer, ShmRingProducer<Addr>. Fica à parte de cache_sim.h
+// para que só quem usa o anel inclua os cabeçalhos POSIX e exija atômicos
+// sem trava.
+//
+// API estável (CACHE_SIM_API_VERSION):
+//   ShmRingProducer<Addr>(name): try_push(addrs, n, ops), close()
+#ifndef CACHE_SIM_SHM_H
+#define CACHE_SIM_SHM_H
+
+#include "cache_sim.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CACHE_SIM_HAVE_SHM 1
+#endif
+
+namespace cache_sim {
+
+// Anel em memória compartilhada do modo --serve: um produtor (o tracer) e
+// um consumidor (o simulador), sem travas. O produtor só escreve head e os
+// registros, o consumidor só escreve tail; cada lado publica o seu com
+// release e lê o do outro com acquire, e os dois ficam em linhas de cache
+// separadas. Após o cabeçalho vêm capacity endereços de addr_bits bits, na
+// ordem de bytes do host, e com SHM_FLAG_OPS capacity bytes de operação (OP_*).
+// O simulador preenche o cabeçalho e só então grava SHM_READY em ready com
+// release; o tracer lê ready com acquire antes de qualquer outro campo.
+constexpr char SHM_MAGIC[8] = {'C', 'S', 'I', 'M', 'S', 'H', 'M', '1'};
+constexpr uint32_t SHM_FLAG_OPS = 1;
+constexpr uint32_t SHM_READY = 1;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "o anel compartilhado exige atômicos sem trava");
+
+struct ShmRingHeader {
+    char magic[8];
+    uint32_t addr_bits;
+    uint32_t flags;
+    uint64_t capacity;                          // registros, potência de 2
+    std::atomic<uint32_t> ready;                // SHM_READY com o cabeçalho completo
+    alignas(64) std::atomic<uint64_t> head;     // registros publicados (produtor)
+    alignas(64) std::atomic<uint64_t> tail;     // registros consumidos (simulador)
+    alignas(64) std::atomic<uint32_t> closed;   // o produtor terminou
+};
+
+inline size_t shm_ring_bytes(uint64_t capacity, uint32_t addr_bits, bool ops) {
+    return sizeof(ShmRingHeader) + capacity * (addr_bits / 8) + (ops ? capacity : 0);
+}
+
+#ifdef CACHE_SIM_HAVE_SHM
+// Lado do tracer: anexa ao anel criado pelo simulador (--serve NAME) e
+// publica lotes sem nunca esperar por ele
+template<typename Addr = uint32_t>
+class ShmRingProducer {
+public:
+    explicit ShmRingProducer(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            throw std::runtime_error("Erro ao abrir memória compartilhada: " + name);
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(ShmRingHeader)) {
+            size = static_cast<size_t>(st.st_size);
+            p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error("Erro ao mapear memória compartilhada: " + name);
+        ring = static_cast<ShmRingHeader*>(p);
+        // O acquire em ready sincroniza com o release do simulador; só
+        // depois dele os demais campos do cabeçalho podem ser lidos
+        if (ring->ready.load(std::memory_order_acquire) != SHM_READY) {
+            munmap(p, size);
+            throw std::runtime_error("Erro: anel " + name + " ainda não está pronto");
+        }
+        if (memcmp(ring->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 ||
+            ring->addr_bits != 8 * sizeof(Addr) ||
+            size < shm_ring_bytes(ring->capacity, ring->addr_bits, ring->flags & SHM_FLAG_OPS)) {
+            munmap(p, size);
+            throw std::runtime_error("Erro: " + name + " não é um anel do simulador de " +
+                                std::to_string(8 * sizeof(Addr)) + " bits");
+        }
+        addrs = reinterpret_cast<Addr*>(ring + 1);
+        if (ring->flags & SHM_FLAG_OPS) ops = reinterpret_cast<uint8_t*>(addrs + ring->capacity);
+        head = ring->head.load(std::memory_order_relaxed);
+    }
+
+    ~ShmRingProducer() { munmap(ring, size); }
+
+    ShmRingProducer(const ShmRingProducer&) = delete;
+    ShmRingProducer& operator=(const ShmRingProducer&) = delete;
+
+    // Publica até n registros e retorna quantos couberam (0 com o anel
+    // cheio); op pode ser nullptr (leituras) e é ignorado sem SHM_FLAG_OPS
+    size_t try_push(const Addr* a, size_t n, const uint8_t* op = nullptr) {
+        const uint64_t cap = ring->capacity;
+        uint64_t room = cap - (head - ring->tail.load(std::memory_order_acquire));
+        size_t k = static_cast<size_t>(std::min<uint64_t>(n, room));
+        size_t at = static_cast<size_t>(head & (cap - 1));
+        size_t first = std::min<size_t>(k, cap - at);
+        memcpy(addrs + at, a, first * sizeof(Addr));
+        memcpy(addrs, a + first, (k - first) * sizeof(Addr));
+        if (ops) {
+            if (op) {
+                memcpy(ops + at, op, first);
+                memcpy(ops, op + first, k - first);
+            } else {
+                memset(ops + at, OP_READ, first);
+                memset(ops, OP_READ, k - first);
+            }
+        }
+        head += k;
+        ring->head.store(head, std::memory_order_release);
+        return k;
+    }
+
+    // Fim do trace: o simulador termina depois de consumir o que falta
+    void close() { ring->closed.store(1, std::memory_order_release); }
+
+private:
+    ShmRingHeader* ring = nullptr;
+    size_t size = 0;
+    Addr* addrs = nullptr;
+    uint8_t* ops = nullptr;
+    uint64_t head = 0;
+};
+#endif
+
+}  // namespace cache_sim
+
+#endif
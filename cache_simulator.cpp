@@ -1,287 +1,2643 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
-#include <cmath>
 #include <cstdint>
+#include <cinttypes>
 #include <cstring>
 #include <cstdlib>
 #include <string>
 #include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cctype>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <type_traits>
+#include <exception>
+#include <chrono>
+#include <cmath>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#define TRACE_HAVE_MMAP 1
+#define TRACE_HAVE_SPAWN 1
+extern char** environ;
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define PROFILE_HAVE_PERF 1
+#endif
+
+#include "cache_sim.h"
+#include "cache_sim_shm.h"
 
 using namespace std;
+using namespace cache_sim;
+using namespace cache_sim::detail;
 
-enum class Replacement { LRU, FIFO, RANDOM };
+uint32_t swap_endian(uint32_t value) {
+    return ((value >> 24) & 0xFF) |
+           ((value >> 8)  & 0xFF00) |
+           ((value << 8)  & 0xFF0000) |
+           ((value << 24) & 0xFF000000);
+}
 
-struct LRU_Node {
-    int line_index;
-    LRU_Node* prev;
-    LRU_Node* next;
-};
+// Converte n palavras big-endian de src para a ordem do host em dst
+void swap_endian_block(uint32_t* dst, const unsigned char* src, size_t n) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(dst, src, n * sizeof(uint32_t));
+#else
+    size_t i = 0;
+#if defined(CACHE_SIM_TAG_MATCH_X86) && defined(__SSSE3__)
+    const __m128i shuf = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                                       11, 10, 9, 8, 15, 14, 13, 12);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(v, shuf));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        uint8x16_t v = vld1q_u8(src + i * 4);
+        vst1q_u32(dst + i, vreinterpretq_u32_u8(vrev32q_u8(v)));
+    }
+#endif
+    for (; i < n; ++i) {
+        uint32_t w;
+        memcpy(&w, src + i * 4, sizeof(w));
+        dst[i] = swap_endian(w);
+    }
+#endif
+}
+
+// Endereços de 64 bits: a composição byte a byte vira bswap/movbe
+void swap_endian_block(uint64_t* dst, const unsigned char* src, size_t n) {
+    for (size_t i = 0; i < n; ++i, src += 8) {
+        uint64_t v = 0;
+        for (int b = 0; b < 8; ++b) v = (v << 8) | src[b];
+        dst[i] = v;
+    }
+}
+
+// Registro R/W: byte de operação (OP_*) seguido do endereço big-endian
+template<typename Addr>
+void decode_rw_block(Addr* dst, uint8_t* ops, const unsigned char* src, size_t n) {
+    for (size_t i = 0; i < n; ++i, src += 1 + sizeof(Addr)) {
+        if (src[0] > OP_IFETCH)
+            throw runtime_error("Erro: operação inválida no trace: " + to_string(src[0]));
+        ops[i] = src[0];
+        Addr a = 0;
+        for (size_t b = 1; b <= sizeof(Addr); ++b) a = (a << 8) | src[b];
+        dst[i] = a;
+    }
+}
+
+enum class TraceFormat { ADDR, RW, ADDR64, RW64 };
+
+inline bool trace_has_ops(TraceFormat f) {
+    return f == TraceFormat::RW || f == TraceFormat::RW64;
+}
+
+inline uint32_t trace_addr_bits(TraceFormat f) {
+    return (f == TraceFormat::ADDR64 || f == TraceFormat::RW64) ? 64 : 32;
+}
+
+// --compression: AUTO reconhece o formato pelo cabeçalho, NONE lê o arquivo
+// como está; os demais forçam o descompressor
+enum class Compression { AUTO, NONE, GZIP, ZSTD, LZ4, XZ, BZIP2 };
+
+// Na ordem de Compression; a partir de GZIP é também o comando do descompressor
+const char* const COMPRESSION_NAMES[] = {"auto", "none", "gzip", "zstd", "lz4", "xz", "bzip2"};
 
-struct FIFO_Queue {
-    vector<int> queue;
-    vector<bool> in_queue;
-    int front = 0;
-    int rear = -1;
-    int size = 0;
-    int capacity;
+// Bytes inspecionados no início do trace (comprimido ou nativo)
+constexpr size_t MAGIC_PROBE = 16;
 
-    FIFO_Queue(int cap) : capacity(cap) {
-        queue.resize(capacity);
-        in_queue.resize(capacity, false);
+// Descompressor externo pelos n primeiros bytes do arquivo; nullptr se não
+// estiver comprimido. Confere o cabeçalho inteiro do contêiner, e não só os
+// mágicos, para que um trace cru que comece pelos mesmos bytes não seja
+// desviado: gzip com método deflate e flags reservadas zeradas, zstd e lz4
+// com os bits reservados do descritor zerados (e a versão 01 no lz4), xz com
+// as flags do stream válidas e bzip2 com o nível e o mágico do primeiro bloco
+const char* detect_compression(const unsigned char* m, size_t n) {
+    if (n >= 4 && m[0] == 0x1f && m[1] == 0x8b && m[2] == 0x08 && (m[3] & 0xe0) == 0)
+        return "gzip";
+    if (n >= 5 && memcmp(m, "\x28\xb5\x2f\xfd", 4) == 0 && (m[4] & 0x08) == 0) return "zstd";
+    if (n >= 5 && memcmp(m, "\x04\x22\x4d\x18", 4) == 0 && (m[4] & 0xc2) == 0x40) return "lz4";
+    if (n >= 8 && memcmp(m, "\xfd" "7zXZ\0", 6) == 0 && m[6] == 0 && (m[7] & 0xf0) == 0)
+        return "xz";
+    if (n >= 10 && memcmp(m, "BZh", 3) == 0 && m[3] >= '1' && m[3] <= '9' &&
+        (memcmp(m + 4, "\x31\x41\x59\x26\x53\x59", 6) == 0 ||
+         memcmp(m + 4, "\x17\x72\x45\x38\x50\x90", 6) == 0))
+        return "bzip2";
+    return nullptr;
+}
+
+// Formato nativo (--convert): cabeçalho de 24 bytes (NATIVE_MAGIC, bits do
+// endereço, flags, registros por bloco), blocos independentes, índice dos
+// blocos e rodapé de 32 bytes (posição do índice, número de blocos, total de
+// registros, NATIVE_INDEX_MAGIC). Em cada bloco o endereço é a diferença
+// para o anterior (o primeiro para 0), em zigzag e varint LEB128, precedida
+// do byte de operação nos formatos R/W. Campos fixos em little-endian.
+const char NATIVE_MAGIC[8] = {'C', 'S', 'I', 'M', 'T', 'R', 'C', '1'};
+const char NATIVE_INDEX_MAGIC[8] = {'C', 'S', 'I', 'M', 'I', 'D', 'X', '1'};
+constexpr size_t NATIVE_HEADER = 24, NATIVE_INDEX_ENTRY = 24, NATIVE_FOOTER = 32;
+constexpr uint32_t NATIVE_FLAG_OPS = 1;
+
+inline void put_le(unsigned char* p, uint64_t v, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+inline uint64_t get_le(const unsigned char* p, size_t bytes) {
+    uint64_t v = 0;
+    for (size_t i = bytes; i-- > 0;) v = (v << 8) | p[i];
+    return v;
+}
+
+// Pelos n primeiros bytes do arquivo, como detect_compression
+bool is_native_trace(const unsigned char* m, size_t n) {
+    return n >= sizeof(NATIVE_MAGIC) && memcmp(m, NATIVE_MAGIC, sizeof(NATIVE_MAGIC)) == 0;
+}
+
+const char* trace_format_name(bool ops, uint32_t bits) {
+    if (bits == 64) return ops ? "rw64" : "addr64";
+    return ops ? "rw" : "addr";
+}
+
+// Decodifica um bloco do formato nativo com n registros em bytes bytes
+template<typename Addr>
+void decode_native_chunk(Addr* dst, uint8_t* ops, const unsigned char* src, size_t bytes,
+                         size_t n) {
+    const unsigned char* end = src + bytes;
+    // Um registro ocupa no máximo o byte de operação e o varint inteiro;
+    // longe do fim do bloco os limites não precisam ser conferidos byte a byte
+    constexpr size_t max_record = 1 + (8 * sizeof(Addr) + 6) / 7;
+    Addr prev = 0;
+    size_t i = 0;
+    for (; i < n && static_cast<size_t>(end - src) >= max_record; ++i) {
+        if (ops) {
+            if (*src > OP_IFETCH)
+                throw runtime_error("Erro: operação inválida no trace: " + to_string(*src));
+            ops[i] = *src++;
+        }
+        Addr z = *src & 0x7F;
+        for (uint32_t shift = 7; *src++ & 0x80; shift += 7) {
+            if (shift >= 8 * sizeof(Addr))
+                throw runtime_error("Erro: trace nativo corrompido");
+            z |= static_cast<Addr>(*src & 0x7F) << shift;
+        }
+        prev += (z >> 1) ^ (Addr(0) - (z & 1));
+        dst[i] = prev;
     }
+    for (; i < n; ++i) {
+        if (ops) {
+            if (src == end) throw runtime_error("Erro: trace nativo corrompido");
+            if (*src > OP_IFETCH)
+                throw runtime_error("Erro: operação inválida no trace: " + to_string(*src));
+            ops[i] = *src++;
+        }
+        Addr z = 0;
+        for (uint32_t shift = 0;; shift += 7) {
+            if (src == end || shift >= 8 * sizeof(Addr))
+                throw runtime_error("Erro: trace nativo corrompido");
+            unsigned char b = *src++;
+            z |= static_cast<Addr>(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        prev += (z >> 1) ^ (Addr(0) - (z & 1));
+        dst[i] = prev;
+    }
+    if (src != end) throw runtime_error("Erro: trace nativo corrompido");
+}
+
+// Contadores de hardware (--profile) da thread que os abre, só em modo
+// usuário; ficam indisponíveis quando o kernel não permite perf_event_open
+class PerfCounters {
+public:
+    static constexpr size_t COUNT = 3;   // ciclos, instruções, misses de LLC
+
+    PerfCounters() {
+#ifdef PROFILE_HAVE_PERF
+        const uint64_t configs[COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                         PERF_COUNT_HW_CACHE_MISSES};
+        for (size_t i = 0; i < COUNT; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (fds[i] < 0) {
+                close_all();
+                return;
+            }
+        }
+#endif
+    }
+
+    ~PerfCounters() { close_all(); }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
 
-    int enqueue(int line_index) {
-        if (in_queue[line_index]) return 0;
-        rear = (rear + 1) % capacity;
-        queue[rear] = line_index;
-        in_queue[line_index] = true;
-        size++;
-        return 0;
+    bool available() const { return fds[0] >= 0; }
+
+    void start() {
+#ifdef PROFILE_HAVE_PERF
+        for (int fd : fds)
+            if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
     }
 
-    int dequeue() {
-        int victim = queue[front];
-        front = (front + 1) % capacity;
-        in_queue[victim] = false;
-        size--;
-        return victim;
+    void stop() {
+#ifdef PROFILE_HAVE_PERF
+        for (int fd : fds)
+            if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
     }
-};
 
+    uint64_t value(size_t i) const {
+        uint64_t v = 0;
+#ifdef PROFILE_HAVE_PERF
+        if (fds[i] < 0 || ::read(fds[i], &v, sizeof(v)) != sizeof(v)) v = 0;
+#else
+        (void)i;
+#endif
+        return v;
+    }
 
-struct Line {
-    bool valid = false;
-    uint32_t tag = 0;
-    LRU_Node* lru_node = nullptr;
+private:
+    void close_all() {
+#ifdef PROFILE_HAVE_PERF
+        for (int& fd : fds) {
+            if (fd >= 0) close(fd);
+            fd = -1;
+        }
+#endif
+    }
+
+    int fds[COUNT] = {-1, -1, -1};
 };
 
-struct Set {
-    vector<Line> lines;
-    LRU_Node* lru_head = nullptr;
-    LRU_Node* lru_tail = nullptr;
-    FIFO_Queue* fifo = nullptr;
+// Tempo acumulado por fase com --profile, em segundos. Nos modos com
+// threads a simulação é o tempo em que a thread principal espera por elas
+// e não há contadores de hardware.
+struct Profile {
+    double io = 0, decode = 0, sim = 0;
+    unique_ptr<PerfCounters> perf;
 
-    Set(int assoc, Replacement repl) {
-        lines.resize(assoc);
-        if (repl == Replacement::FIFO) {
-            fifo = new FIFO_Queue(assoc);
+    void print(bool modo) const {
+        bool hw = perf && perf->available();
+        uint64_t cycles = hw ? perf->value(0) : 0;
+        uint64_t instructions = hw ? perf->value(1) : 0;
+        uint64_t llc_misses = hw ? perf->value(2) : 0;
+        if (modo) {
+            printf("perfil %.3lf %.3lf %.3lf", io * 1e3, decode * 1e3, sim * 1e3);
+            if (hw)
+                printf(" %" PRIu64 " %" PRIu64 " %" PRIu64, cycles, instructions, llc_misses);
+            printf("\n");
+            return;
         }
+        printf("Perfil:\n");
+        printf("- Leitura do trace (E/S): %.3lf ms\n", io * 1e3);
+        printf("- Conversão de endianness: %.3lf ms\n", decode * 1e3);
+        printf("- Simulação: %.3lf ms\n", sim * 1e3);
+        if (!hw) {
+            printf("- Contadores de hardware: indisponíveis\n");
+            return;
+        }
+        printf("- Ciclos: %" PRIu64 "\n", cycles);
+        printf("- Instruções: %" PRIu64 " (IPC %.2lf)\n", instructions,
+               cycles ? static_cast<double>(instructions) / cycles : 0.0);
+        printf("- Misses de LLC: %" PRIu64 "\n", llc_misses);
     }
+};
 
-    ~Set() {
-        if (fifo) delete fifo;
-        while (lru_head) {
-            LRU_Node* tmp = lru_head;
-            lru_head = lru_head->next;
-            delete tmp;
+// Soma a duração do escopo em *acc e mantém os contadores ligados nele;
+// com acc e perf nulos (sem --profile) não mede nada
+class PhaseTimer {
+public:
+    PhaseTimer(double* a, PerfCounters* p) : acc(a), perf(p) {
+        if (perf) perf->start();
+        if (acc) t0 = chrono::steady_clock::now();
+    }
+
+    ~PhaseTimer() {
+        if (acc) *acc += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        if (perf) perf->stop();
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    double* acc;
+    PerfCounters* perf;
+    chrono::steady_clock::time_point t0;
+};
+
+inline PhaseTimer profile_phase(Profile* p, double Profile::*field, bool counters = false) {
+    return PhaseTimer(p ? &(p->*field) : nullptr, p && counters ? p->perf.get() : nullptr);
+}
+
+// Leitor de trace: mapeia o arquivo em memória quando possível e,
+// caso contrário (pipes, stdin "-"), lê em blocos via fread. Arquivos
+// comprimidos passam por um descompressor externo; uma thread produtora lê
+// a saída dele e decodifica os registros num anel de blocos, de modo que
+// descompressão, decodificação e simulação se sobrepõem. No formato nativo
+// a produtora decodifica os blocos do arquivo mapeado no mesmo anel. Com
+// serve_records > 0 (--serve) filename é o nome do anel de memória
+// compartilhada que o leitor cria com essa capacidade e um tracer alimenta.
+class TraceReader {
+public:
+    static constexpr size_t BLOCK = 1 << 16;
+    static constexpr size_t RING = 4;
+
+    explicit TraceReader(const string& filename, TraceFormat fmt = TraceFormat::ADDR,
+                         uint64_t serve_records = 0, Compression comp = Compression::AUTO)
+        : format(fmt), record(trace_addr_bits(fmt) / 8 + (trace_has_ops(fmt) ? 1 : 0)),
+          name(filename) {
+        if (serve_records) {
+            open_shm(serve_records);
+            return;
+        }
+        // Descompressor forçado: vale também para stdin e pipes ("-dc -")
+        if (comp != Compression::AUTO && comp != Compression::NONE) {
+            start_decompressor(COMPRESSION_NAMES[static_cast<int>(comp)]);
+            return;
+        }
+        if (filename == "-") {
+            stream = stdin;
+            return;
+        }
+        bool sniff = comp == Compression::AUTO;
+        unsigned char magic[MAGIC_PROBE];
+#ifdef TRACE_HAVE_MMAP
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw runtime_error("Erro ao abrir arquivo: " + filename);
+        struct stat st;
+        // Só arquivos regulares são inspecionados e mapeados: num pipe ou
+        // FIFO os bytes mágicos seriam consumidos do trace, que então é lido
+        // como está pelo mesmo descritor, como o stdin
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            ssize_t got = pread(fd, magic, sizeof(magic), 0);
+            size_t n = got > 0 ? static_cast<size_t>(got) : 0;
+            if (const char* tool = sniff ? detect_compression(magic, n) : nullptr) {
+                close(fd);
+                start_decompressor(tool);
+                return;
+            }
+            if (is_native_trace(magic, n)) {
+                close(fd);
+                open_native();
+                return;
+            }
+            map_size = static_cast<size_t>(st.st_size);
+            if (map_size == 0) {
+                close(fd);
+                mapped = true;
+                return;
+            }
+            void* p = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                close(fd);
+                madvise(p, map_size, MADV_SEQUENTIAL);
+                map = static_cast<const unsigned char*>(p);
+                mapped = true;
+                return;
+            }
         }
+        stream = fdopen(fd, "rb");
+        if (!stream) {
+            close(fd);
+            throw runtime_error("Erro ao abrir arquivo: " + filename);
+        }
+        owns_stream = true;
+#else
+        stream = fopen(filename.c_str(), "rb");
+        if (!stream)
+            throw runtime_error("Erro ao abrir arquivo: " + filename);
+        size_t got = fread(magic, 1, sizeof(magic), stream);
+        if (const char* tool = sniff ? detect_compression(magic, got) : nullptr) {
+            fclose(stream);
+            stream = nullptr;
+            start_decompressor(tool);
+            return;
+        }
+        if (is_native_trace(magic, got)) {
+            fclose(stream);
+            stream = nullptr;
+            open_native();
+            return;
+        }
+        // Sem fstat não há como distinguir um pipe: recusa o que não volta
+        // ao início em vez de perder os bytes já lidos
+        if (fseek(stream, 0, SEEK_SET) != 0) {
+            fclose(stream);
+            throw runtime_error("Erro: trace não pode ser reposicionado: " + filename);
+        }
+        owns_stream = true;
+#endif
     }
 
-    void append_lru(LRU_Node* node) {
-        if (!lru_head) {
-            lru_head = lru_tail = node;
-        } else {
-            lru_tail->next = node;
-            node->prev = lru_tail;
-            lru_tail = node;
+    ~TraceReader() {
+#ifdef CACHE_SIM_HAVE_SHM
+        if (shm_ring) {
+            munmap(shm_ring, shm_size);
+            shm_unlink(name.c_str());
+            return;
+        }
+#endif
+        if (producer.joinable()) {
+            bool running;
+            {
+                lock_guard<mutex> lk(ring_mutex);
+                stop = true;
+                running = !done;
+            }
+            not_full.notify_all();
+#ifdef TRACE_HAVE_SPAWN
+            // Interrompe o descompressor para destravar uma leitura pendente
+            if (running && child) kill(child, SIGTERM);
+#else
+            (void)running;
+#endif
+            producer.join();
         }
+#ifdef TRACE_HAVE_SPAWN
+        if (child) {
+            fclose(stream);
+            if (!reaped) waitpid(child, nullptr, 0);
+            return;
+        }
+#endif
+#ifdef TRACE_HAVE_MMAP
+        if (map) munmap(const_cast<unsigned char*>(map), map_size);
+#endif
+        if (owns_stream) fclose(stream);
     }
 
-    void remove_lru(LRU_Node* node) {
-        if (node->prev)
-            node->prev->next = node->next;
-        else
-            lru_head = node->next;
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
 
-        if (node->next)
-            node->next->prev = node->prev;
+    // Preenche out com até max endereços já na ordem do host (e ops com o
+    // tipo de cada acesso no formato R/W); 0 = fim do trace. Addr deve ter
+    // a largura de endereço do formato.
+    template<typename Addr>
+    size_t read(Addr* out, size_t max, uint8_t* ops = nullptr) {
+        if (shm_ring) return read_shm(out, max, ops);
+        if (native && !producer.joinable()) producer = thread(&TraceReader::produce_native, this);
+        if (producer.joinable()) return read_ring(out, max, ops);
+        const unsigned char* src;
+        size_t n;
+        {
+            PhaseTimer t = profile_phase(profile, &Profile::io);
+            if (mapped) {
+                n = min(max, (map_size - pos) / record);
+                src = map + pos;
+                pos += n * record;
+                // Com --profile as faltas de página do bloco contam como E/S
+                if (profile) touch_pages(src, n * record);
+            } else {
+                raw.resize(max * record);
+                n = fread(raw.data(), 1, raw.size(), stream) / record;
+                src = raw.data();
+            }
+        }
+        PhaseTimer t = profile_phase(profile, &Profile::decode);
+        if (trace_has_ops(format))
+            decode_rw_block(out, ops, src, n);
         else
-            lru_tail = node->prev;
+            swap_endian_block(out, src, n);
+        return n;
+    }
+
+    // Descarta até n registros (retomada com --resume); retorna quantos
+    // havia. Addr deve ter a largura de endereço do formato.
+    template<typename Addr>
+    uint64_t skip(uint64_t n) {
+        if (native && !producer.joinable()) {
+            // O índice leva direto ao bloco que contém o registro n
+            auto it = upper_bound(chunks.begin(), chunks.end(), n,
+                                  [](uint64_t v, const NativeChunk& c) { return v < c.first; });
+            if (it != chunks.begin()) --it;
+            next_chunk = static_cast<size_t>(it - chunks.begin());
+            uint64_t base = chunks.empty() ? 0 : it->first;
+            producer = thread(&TraceReader::produce_native, this);
+            return base + skip<Addr>(n - base);
+        }
+        if (mapped) {
+            uint64_t k = min<uint64_t>(n, (map_size - pos) / record);
+            pos += k * record;
+            return k;
+        }
+        vector<Addr> scratch(BLOCK);
+        vector<uint8_t> ops(trace_has_ops(format) ? BLOCK : 0);
+        uint64_t skipped = 0;
+        size_t got;
+        while (skipped < n &&
+               (got = read(scratch.data(), min<uint64_t>(BLOCK, n - skipped), ops.data())) > 0)
+            skipped += got;
+        return skipped;
+    }
+
+    // Passa a acumular os tempos de leitura em p (nullptr desliga)
+    void set_profile(Profile* p) { profile = p; }
+
+private:
+    // Bloco decodificado do anel; só a largura de endereço do formato é usada
+    struct Slot {
+        vector<uint32_t> a32;
+        vector<uint64_t> a64;
+        vector<uint8_t> ops;
+        size_t n = 0;
+    };
 
-        node->prev = node->next = nullptr;
+    // Posição de cada bloco do formato nativo, lida do índice
+    struct NativeChunk {
+        uint64_t offset, first;
+        uint32_t records, bytes;
+    };
+
+    // Cria o anel compartilhado; um anel com o mesmo nome (de outro servidor
+    // ou de uma execução interrompida) não é reaproveitado
+    void open_shm(uint64_t capacity) {
+#ifdef CACHE_SIM_HAVE_SHM
+        bool with_ops = trace_has_ops(format);
+        shm_size = shm_ring_bytes(capacity, trace_addr_bits(format), with_ops);
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+            throw runtime_error("Erro ao criar memória compartilhada " + name + ": " + strerror(errno));
+        void* p = MAP_FAILED;
+        if (ftruncate(fd, static_cast<off_t>(shm_size)) == 0)
+            p = mmap(nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            throw runtime_error("Erro ao mapear memória compartilhada: " + name);
+        }
+        // O segmento recém-criado é todo zero, então ready já vale 0 para
+        // um tracer que o mapeie antes da publicação
+        shm_ring = new (p) ShmRingHeader();
+        memcpy(shm_ring->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+        shm_ring->addr_bits = trace_addr_bits(format);
+        shm_ring->flags = with_ops ? SHM_FLAG_OPS : 0;
+        shm_ring->capacity = capacity;
+        shm_addrs = reinterpret_cast<unsigned char*>(shm_ring + 1);
+        shm_ops = with_ops ? shm_addrs + capacity * (trace_addr_bits(format) / 8) : nullptr;
+        // Publica o cabeçalho: o tracer só o lê depois de ver SHM_READY
+        shm_ring->ready.store(SHM_READY, memory_order_release);
+#else
+        (void)capacity;
+        throw runtime_error("Erro: --serve não suportado nesta plataforma");
+#endif
     }
-};
 
-class Cache {
-public:
-    vector<Set*> sets;
-    uint32_t n_sets, block_size, assoc;
-    Replacement repl;
-    uint32_t total_valid_lines = 0;
-    uint32_t accesses = 0;
-    uint32_t hits = 0;
-    uint32_t misses = 0;
-    uint32_t miss_compulsory = 0;
-    uint32_t miss_capacity = 0;
-    uint32_t miss_conflict = 0;
-
-    Cache(uint32_t ns, uint32_t bs, uint32_t a, Replacement r)
-        : n_sets(ns), block_size(bs), assoc(a), repl(r) {
-        for (uint32_t i = 0; i < ns; ++i)
-            sets.push_back(new Set(a, r));
-    }
-
-    ~Cache() {
-        for (auto s : sets) delete s;
-    }
-
-    void access(uint32_t address) {
-        uint32_t offset_bits = log2(block_size);
-        uint32_t index_bits = log2(n_sets);
-        uint32_t index = (address >> offset_bits) & ((1 << index_bits) - 1);
-        uint32_t tag = address >> (offset_bits + index_bits);
-
-        accesses++;
-        Set* set = sets[index];
-
-        // HIT
-        for (uint32_t i = 0; i < assoc; ++i) {
-            if (set->lines[i].valid && set->lines[i].tag == tag) {
-                if (repl == Replacement::LRU && set->lines[i].lru_node) {
-                    set->remove_lru(set->lines[i].lru_node);
-                    set->append_lru(set->lines[i].lru_node);
+    // Devolve o que o tracer já publicou (até max), esperando enquanto o
+    // anel está vazio; 0 só depois que ele fecha o anel e tudo foi consumido
+    template<typename Addr>
+    size_t read_shm(Addr* out, size_t max, uint8_t* ops) {
+        PhaseTimer t = profile_phase(profile, &Profile::io);
+        const uint64_t cap = shm_ring->capacity;
+        for (unsigned spins = 0;; ++spins) {
+            uint64_t published = shm_ring->head.load(memory_order_acquire);
+            if (published != shm_tail) {
+                size_t k = static_cast<size_t>(min<uint64_t>(max, published - shm_tail));
+                size_t at = static_cast<size_t>(shm_tail & (cap - 1));
+                size_t first = min<size_t>(k, cap - at);
+                const Addr* src = reinterpret_cast<const Addr*>(shm_addrs);
+                memcpy(out, src + at, first * sizeof(Addr));
+                memcpy(out + first, src, (k - first) * sizeof(Addr));
+                if (ops) {
+                    memcpy(ops, shm_ops + at, first);
+                    memcpy(ops + first, shm_ops, k - first);
+                    for (size_t i = 0; i < k; ++i)
+                        if (ops[i] > OP_IFETCH)
+                            throw runtime_error("Erro: operação inválida no trace: " + to_string(ops[i]));
                 }
-                hits++;
-                return;
+                shm_tail += k;
+                shm_ring->tail.store(shm_tail, memory_order_release);
+                return k;
             }
+            // Depois de ver closed, um último head confirma que nada falta
+            if (shm_ring->closed.load(memory_order_acquire) &&
+                shm_ring->head.load(memory_order_acquire) == shm_tail)
+                return 0;
+            if (spins < 64)
+                continue;
+            else if (spins < 1024)
+                this_thread::yield();
+            else
+                this_thread::sleep_for(chrono::microseconds(50));
         }
-        misses++;
+    }
 
-        // Compulsório
-        for (uint32_t i = 0; i < assoc; ++i) {
-            if (!set->lines[i].valid) {
-                set->lines[i].valid = true;
-                set->lines[i].tag = tag;
+    void alloc_ring() {
+        for (Slot& s : ring) {
+            if (trace_addr_bits(format) == 64)
+                s.a64.resize(BLOCK);
+            else
+                s.a32.resize(BLOCK);
+            if (trace_has_ops(format)) s.ops.resize(BLOCK);
+        }
+    }
 
-                if (repl == Replacement::LRU) {
-                    auto* node = new LRU_Node{static_cast<int>(i), nullptr, nullptr};
-                    set->lines[i].lru_node = node;
-                    set->append_lru(node);
-                } else if (repl == Replacement::FIFO) {
-                    set->fifo->enqueue(i);
+    // Mapeia (ou carrega) o arquivo nativo e confere cabeçalho, rodapé e
+    // índice; a decodificação começa na primeira leitura
+    void open_native() {
+        native = true;
+        reaped = true;
+#ifdef TRACE_HAVE_MMAP
+        int fd = open(name.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                map = static_cast<const unsigned char*>(p);
+                map_size = static_cast<size_t>(st.st_size);
+            }
+        }
+        if (fd >= 0) close(fd);
+#endif
+        native_data = map;
+        size_t size = map_size;
+        if (!map) {
+            FILE* f = fopen(name.c_str(), "rb");
+            if (!f)
+                throw runtime_error("Erro ao abrir arquivo: " + name);
+            unsigned char buf[1 << 16];
+            size_t got;
+            while ((got = fread(buf, 1, sizeof(buf), f)) > 0) raw.insert(raw.end(), buf, buf + got);
+            fclose(f);
+            native_data = raw.data();
+            size = raw.size();
+        }
+
+        const runtime_error corrupt("Erro: trace nativo corrompido: " + name);
+        if (size < NATIVE_HEADER + NATIVE_FOOTER) throw corrupt;
+        uint32_t bits = static_cast<uint32_t>(get_le(native_data + 8, 4));
+        bool ops = (get_le(native_data + 12, 4) & NATIVE_FLAG_OPS) != 0;
+        if (bits != trace_addr_bits(format) || ops != trace_has_ops(format))
+            throw runtime_error("Erro: " + name + " foi gravado com --format " + trace_format_name(ops, bits));
+        const unsigned char* foot = native_data + size - NATIVE_FOOTER;
+        if (memcmp(foot + 24, NATIVE_INDEX_MAGIC, 8) != 0) throw corrupt;
+        uint64_t index_at = get_le(foot, 8), count = get_le(foot + 8, 8), total = get_le(foot + 16, 8);
+        uint64_t index_end = size - NATIVE_FOOTER;
+        if (index_at < NATIVE_HEADER || index_at > index_end ||
+            index_end - index_at != count * NATIVE_INDEX_ENTRY)
+            throw corrupt;
+        uint64_t first = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            const unsigned char* e = native_data + index_at + i * NATIVE_INDEX_ENTRY;
+            NativeChunk c{get_le(e, 8), get_le(e + 8, 8), static_cast<uint32_t>(get_le(e + 16, 4)),
+                          static_cast<uint32_t>(get_le(e + 20, 4))};
+            if (c.first != first || c.records == 0 || c.records > BLOCK ||
+                c.offset < NATIVE_HEADER || c.offset > index_at || c.bytes > index_at - c.offset)
+                throw corrupt;
+            first += c.records;
+            chunks.push_back(c);
+        }
+        if (first != total) throw corrupt;
+        alloc_ring();
+    }
+
+    void produce_native() {
+        try {
+            for (size_t c = next_chunk; c < chunks.size(); ++c) {
+                {
+                    unique_lock<mutex> lk(ring_mutex);
+                    not_full.wait(lk, [this] { return filled < RING || stop; });
+                    if (stop) return;
                 }
+                Slot& s = ring[tail];
+                const NativeChunk& ch = chunks[c];
+                const unsigned char* src = native_data + ch.offset;
+                uint8_t* ops = trace_has_ops(format) ? s.ops.data() : nullptr;
+                if (trace_addr_bits(format) == 64)
+                    decode_native_chunk(s.a64.data(), ops, src, ch.bytes, ch.records);
+                else
+                    decode_native_chunk(s.a32.data(), ops, src, ch.bytes, ch.records);
+                s.n = ch.records;
+                {
+                    lock_guard<mutex> lk(ring_mutex);
+                    tail = (tail + 1) % RING;
+                    filled++;
+                }
+                not_empty.notify_one();
+            }
+        } catch (...) {
+            lock_guard<mutex> lk(ring_mutex);
+            error = current_exception();
+        }
+        {
+            lock_guard<mutex> lk(ring_mutex);
+            done = true;
+        }
+        not_empty.notify_one();
+    }
 
-                miss_compulsory++;
-                total_valid_lines++;
-                return;
+    void start_decompressor(const char* tool) {
+#ifdef TRACE_HAVE_SPAWN
+        int fds[2];
+        if (pipe(fds) != 0)
+            throw runtime_error("Erro ao criar pipe para " + string(tool));
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, fds[0]);
+        posix_spawn_file_actions_addclose(&actions, fds[1]);
+        string dc = "-dc";
+        char* argv[] = {const_cast<char*>(tool), &dc[0], &name[0], nullptr};
+        int err = posix_spawnp(&child, tool, &actions, nullptr, argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(fds[1]);
+        if (err != 0) {
+            close(fds[0]);
+            throw runtime_error("Erro ao executar " + string(tool) + ": " + strerror(err));
+        }
+        stream = fdopen(fds[0], "rb");
+        alloc_ring();
+        producer = thread(&TraceReader::produce, this);
+#else
+        throw runtime_error("Erro: trace comprimido (" + string(tool) + ") não suportado nesta plataforma");
+#endif
+    }
+
+    void produce() {
+        vector<unsigned char> buf(BLOCK * record);
+        try {
+            for (;;) {
+                size_t got = fread(buf.data(), 1, buf.size(), stream);
+                size_t n = got / record;
+                {
+                    unique_lock<mutex> lk(ring_mutex);
+                    not_full.wait(lk, [this] { return filled < RING || stop; });
+                    if (stop) return;
+                }
+                // A posição tail só é tocada pela produtora até ser publicada
+                Slot& s = ring[tail];
+                if (trace_has_ops(format)) {
+                    if (trace_addr_bits(format) == 64)
+                        decode_rw_block(s.a64.data(), s.ops.data(), buf.data(), n);
+                    else
+                        decode_rw_block(s.a32.data(), s.ops.data(), buf.data(), n);
+                } else if (trace_addr_bits(format) == 64) {
+                    swap_endian_block(s.a64.data(), buf.data(), n);
+                } else {
+                    swap_endian_block(s.a32.data(), buf.data(), n);
+                }
+                s.n = n;
+                bool last = got < buf.size();
+                {
+                    lock_guard<mutex> lk(ring_mutex);
+                    if (n > 0) {
+                        tail = (tail + 1) % RING;
+                        filled++;
+                    }
+                    done = last;
+                }
+                not_empty.notify_one();
+                if (last) return;
+            }
+        } catch (...) {
+            lock_guard<mutex> lk(ring_mutex);
+            error = current_exception();
+            done = true;
+        }
+        not_empty.notify_one();
+    }
+
+    static void touch_pages(const unsigned char* p, size_t bytes) {
+        volatile unsigned char sink = 0;
+        for (size_t off = 0; off < bytes; off += 4096) sink = sink + p[off];
+    }
+
+    // A espera pela produtora conta como E/S e a cópia do bloco como
+    // conversão; a decodificação em si corre na thread produtora
+    template<typename Addr>
+    size_t read_ring(Addr* out, size_t max, uint8_t* ops) {
+        size_t total = 0;
+        while (total < max) {
+            {
+                PhaseTimer t = profile_phase(profile, &Profile::io);
+                unique_lock<mutex> lk(ring_mutex);
+                not_empty.wait(lk, [this] { return filled > 0 || done; });
+                if (filled == 0) {
+                    if (error) rethrow_exception(error);
+                    finish_decompressor();
+                    break;
+                }
             }
+            PhaseTimer t = profile_phase(profile, &Profile::decode);
+            Slot& s = ring[head];
+            size_t k = min(max - total, s.n - taken);
+            if constexpr (sizeof(Addr) == 8)
+                memcpy(out + total, s.a64.data() + taken, k * sizeof(Addr));
+            else
+                memcpy(out + total, s.a32.data() + taken, k * sizeof(Addr));
+            if (ops) memcpy(ops + total, s.ops.data() + taken, k);
+            taken += k;
+            total += k;
+            if (taken == s.n) {
+                {
+                    lock_guard<mutex> lk(ring_mutex);
+                    head = (head + 1) % RING;
+                    filled--;
+                }
+                taken = 0;
+                not_full.notify_one();
+            }
+        }
+        return total;
+    }
+
+    // Fim da saída do descompressor: confere o código de saída dele
+    void finish_decompressor() {
+#ifdef TRACE_HAVE_SPAWN
+        if (reaped) return;
+        int status = 0;
+        waitpid(child, &status, 0);
+        reaped = true;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            throw runtime_error("Erro ao descomprimir " + name);
+#endif
+    }
+
+    TraceFormat format;
+    size_t record;
+    string name;
+    bool mapped = false;
+    const unsigned char* map = nullptr;
+    size_t map_size = 0;
+    size_t pos = 0;
+    FILE* stream = nullptr;
+    bool owns_stream = false;
+    vector<unsigned char> raw;
+    Profile* profile = nullptr;
+
+    // Anel compartilhado do --serve
+    ShmRingHeader* shm_ring = nullptr;
+    size_t shm_size = 0;
+    unsigned char* shm_addrs = nullptr;
+    unsigned char* shm_ops = nullptr;
+    uint64_t shm_tail = 0;
+
+    // Formato nativo
+    bool native = false;
+    const unsigned char* native_data = nullptr;
+    vector<NativeChunk> chunks;
+    size_t next_chunk = 0;
+
+    // Entrada comprimida
+    thread producer;
+    Slot ring[RING];
+    size_t head = 0, tail = 0, filled = 0, taken = 0;
+    bool done = false, stop = false, reaped = false;
+    exception_ptr error;
+    mutex ring_mutex;
+    condition_variable not_empty, not_full;
+#ifdef TRACE_HAVE_SPAWN
+    pid_t child = 0;
+#endif
+};
+
+// Gravação do formato nativo (--convert): codifica cada bloco de
+// TraceReader::BLOCK registros assim que ele enche e grava o índice em finish()
+template<typename Addr>
+class NativeTraceWriter {
+public:
+    NativeTraceWriter(const string& filename, TraceFormat fmt)
+        : name(filename), with_ops(trace_has_ops(fmt)) {
+        out = fopen(filename.c_str(), "wb");
+        if (!out)
+            throw runtime_error("Erro ao abrir arquivo: " + filename);
+        unsigned char header[NATIVE_HEADER] = {0};
+        memcpy(header, NATIVE_MAGIC, sizeof(NATIVE_MAGIC));
+        put_le(header + 8, trace_addr_bits(fmt), 4);
+        put_le(header + 12, with_ops ? NATIVE_FLAG_OPS : 0, 4);
+        put_le(header + 16, TraceReader::BLOCK, 4);
+        put(header, sizeof(header));
+    }
+
+    ~NativeTraceWriter() {
+        if (out) fclose(out);
+    }
+
+    NativeTraceWriter(const NativeTraceWriter&) = delete;
+    NativeTraceWriter& operator=(const NativeTraceWriter&) = delete;
+
+    void write(const Addr* addrs, const uint8_t* ops, size_t n) {
+        for (size_t k = 0; k < n; ++k) {
+            if (with_ops) chunk.push_back(ops[k]);
+            Addr d = addrs[k] - prev;
+            Addr z = (d << 1) ^ (Addr(0) - (d >> (8 * sizeof(Addr) - 1)));
+            while (z >= 0x80) {
+                chunk.push_back(static_cast<unsigned char>(z | 0x80));
+                z >>= 7;
+            }
+            chunk.push_back(static_cast<unsigned char>(z));
+            prev = addrs[k];
+            if (++in_chunk == TraceReader::BLOCK) flush();
+        }
+    }
+
+    // Fecha o último bloco e grava o índice e o rodapé
+    void finish() {
+        flush();
+        uint64_t index_at = offset;
+        for (const Entry& e : index) {
+            unsigned char b[NATIVE_INDEX_ENTRY];
+            put_le(b, e.offset, 8);
+            put_le(b + 8, e.first, 8);
+            put_le(b + 16, e.records, 4);
+            put_le(b + 20, e.bytes, 4);
+            put(b, sizeof(b));
+        }
+        unsigned char foot[NATIVE_FOOTER];
+        put_le(foot, index_at, 8);
+        put_le(foot + 8, index.size(), 8);
+        put_le(foot + 16, total, 8);
+        memcpy(foot + 24, NATIVE_INDEX_MAGIC, sizeof(NATIVE_INDEX_MAGIC));
+        put(foot, sizeof(foot));
+        FILE* f = out;
+        out = nullptr;
+        if (fclose(f) != 0)
+            throw runtime_error("Erro ao gravar " + name);
+    }
+
+    uint64_t records() const { return total; }
+    size_t chunk_count() const { return index.size(); }
+    uint64_t bytes() const { return offset; }
+
+private:
+    struct Entry {
+        uint64_t offset, first;
+        uint32_t records, bytes;
+    };
+
+    void put(const unsigned char* p, size_t n) {
+        if (fwrite(p, 1, n, out) != n)
+            throw runtime_error("Erro ao gravar " + name);
+        offset += n;
+    }
+
+    void flush() {
+        if (in_chunk == 0) return;
+        index.push_back(Entry{offset, total, in_chunk, static_cast<uint32_t>(chunk.size())});
+        put(chunk.data(), chunk.size());
+        total += in_chunk;
+        in_chunk = 0;
+        chunk.clear();
+        prev = 0;
+    }
+
+    string name;
+    bool with_ops;
+    FILE* out = nullptr;
+    uint64_t offset = 0, total = 0;
+    vector<unsigned char> chunk;
+    uint32_t in_chunk = 0;
+    Addr prev = 0;
+    vector<Entry> index;
+};
+
+// Conjunto fixo de threads: start() distribui fn(0..n-1) entre elas e
+// wait() bloqueia até todas as tarefas terminarem.
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned n) {
+        for (unsigned i = 0; i < n; ++i)
+            threads.emplace_back(&WorkerPool::worker, this);
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> lk(m);
+            stop = true;
         }
+        cv.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
 
-        // Substituição
-        int victim_index = -1;
-        switch (repl) {
-            case Replacement::RANDOM:
-                victim_index = rand() % assoc;
-                break;
-            case Replacement::LRU:
-                if (set->lru_head)
-                    victim_index = set->lru_head->line_index;
-                break;
-            case Replacement::FIFO:
-                victim_index = set->fifo->dequeue();
-                break;
+    unsigned size() const { return static_cast<unsigned>(threads.size()); }
+
+    void start(size_t n, function<void(size_t)> fn) {
+        {
+            lock_guard<mutex> lk(m);
+            job = move(fn);
+            job_n = n;
+            next = 0;
+            pending = threads.size();
+            generation++;
         }
+        cv.notify_all();
+    }
 
-        set->lines[victim_index].tag = tag;
-        if (repl == Replacement::LRU && set->lines[victim_index].lru_node) {
-            set->remove_lru(set->lines[victim_index].lru_node);
-            set->append_lru(set->lines[victim_index].lru_node);
-        } else if (repl == Replacement::FIFO) {
-            set->fifo->enqueue(victim_index);
+    void wait() {
+        unique_lock<mutex> lk(m);
+        done_cv.wait(lk, [this] { return pending == 0; });
+    }
+
+    void run(size_t n, function<void(size_t)> fn) {
+        start(n, move(fn));
+        wait();
+    }
+
+private:
+    void worker() {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                unique_lock<mutex> lk(m);
+                cv.wait(lk, [&] { return stop || generation != seen; });
+                if (stop) return;
+                seen = generation;
+            }
+            size_t i;
+            while ((i = next.fetch_add(1)) < job_n)
+                job(i);
+            lock_guard<mutex> lk(m);
+            if (--pending == 0) done_cv.notify_all();
         }
+    }
 
-        if (total_valid_lines == n_sets * assoc) {
-            miss_capacity++;
+    vector<thread> threads;
+    mutex m;
+    condition_variable cv, done_cv;
+    function<void(size_t)> job;
+    size_t job_n = 0;
+    atomic<size_t> next{0};
+    size_t pending = 0;
+    uint64_t generation = 0;
+    bool stop = false;
+};
+
+// Estatísticas por janela (--interval). Ao fim de cada janela a simulação
+// copia os contadores acumulados de cada cache para um anel preallocado; uma
+// thread escritora calcula as diferenças e grava uma linha CSV por cache.
+// A simulação só espera se o anel encher.
+class IntervalWriter {
+public:
+    static constexpr size_t RING = 64;   // janelas pendentes
+
+    // filename "-" grava na saída padrão
+    IntervalWriter(const string& filename, size_t n, bool with_rw)
+        : streams(n), rw(with_rw), ring(RING * n), ends(RING), prev(n) {
+        if (filename == "-") {
+            out = stdout;
         } else {
-            miss_conflict++;
+            out = fopen(filename.c_str(), "w");
+            if (!out)
+                throw runtime_error("Erro ao abrir arquivo: " + filename);
+            owns_out = true;
+        }
+        fprintf(out, "cache,fim,acessos,taxa_hits,taxa_misses,compulsorios,capacidade,conflito");
+        if (rw) fprintf(out, ",escritas,taxa_misses_escrita,writebacks,escritas_memoria");
+        fprintf(out, "\n");
+        writer = thread(&IntervalWriter::write_loop, this);
+    }
+
+    ~IntervalWriter() {
+        finish();
+        if (owns_out) fclose(out);
+    }
+
+    IntervalWriter(const IntervalWriter&) = delete;
+    IntervalWriter& operator=(const IntervalWriter&) = delete;
+
+    // Registra a janela que termina no acesso end; stats_of(i) dá os
+    // contadores acumulados da cache i
+    template<typename F>
+    void push(uint64_t end, F&& stats_of) {
+        {
+            unique_lock<mutex> lk(m);
+            not_full.wait(lk, [this] { return filled < RING; });
         }
+        // A posição tail só é tocada pela simulação até ser publicada
+        for (size_t i = 0; i < streams; ++i) ring[tail * streams + i] = stats_of(i);
+        ends[tail] = end;
+        {
+            lock_guard<mutex> lk(m);
+            tail = (tail + 1) % RING;
+            filled++;
+        }
+        not_empty.notify_one();
     }
 
-    void print_stats(bool modo) const {
-        auto r = [](uint32_t n, uint32_t base) -> double {
+    // Contadores de partida (retomada de checkpoint); chamar antes de push()
+    template<typename F>
+    void prime(F&& stats_of) {
+        for (size_t i = 0; i < streams; ++i) prev[i] = stats_of(i);
+    }
+
+    // Grava as janelas pendentes e encerra a escritora
+    void finish() {
+        if (!writer.joinable()) return;
+        {
+            lock_guard<mutex> lk(m);
+            stop = true;
+        }
+        not_empty.notify_one();
+        writer.join();
+        fflush(out);
+    }
+
+private:
+    void write_loop() {
+        auto r = [](uint64_t n, uint64_t base) -> double {
             return (base == 0) ? 0.0 : static_cast<double>(n) / base;
         };
+        for (;;) {
+            {
+                unique_lock<mutex> lk(m);
+                not_empty.wait(lk, [this] { return filled > 0 || stop; });
+                if (filled == 0) return;
+            }
+            for (size_t i = 0; i < streams; ++i) {
+                const CacheStats& cur = ring[head * streams + i];
+                CacheStats& last = prev[i];
+                uint64_t accesses = cur.accesses - last.accesses;
+                uint64_t misses = cur.misses - last.misses;
+                fprintf(out, "%zu,%" PRIu64 ",%" PRIu64 ",%.4lf,%.4lf,%.4lf,%.4lf,%.4lf", i, ends[head],
+                        accesses, r(cur.hits - last.hits, accesses), r(misses, accesses),
+                        r(cur.miss_compulsory - last.miss_compulsory, misses),
+                        r(cur.miss_capacity - last.miss_capacity, misses),
+                        r(cur.miss_conflict - last.miss_conflict, misses));
+                if (rw) {
+                    uint64_t writes = cur.writes - last.writes;
+                    fprintf(out, ",%" PRIu64 ",%.4lf,%" PRIu64 ",%" PRIu64, writes,
+                            r(cur.write_misses - last.write_misses, writes),
+                            cur.writebacks - last.writebacks, cur.mem_writes - last.mem_writes);
+                }
+                fprintf(out, "\n");
+                last = cur;
+            }
+            {
+                lock_guard<mutex> lk(m);
+                head = (head + 1) % RING;
+                filled--;
+            }
+            not_full.notify_one();
+        }
+    }
+
+    FILE* out;
+    bool owns_out = false;
+    size_t streams;
+    bool rw;
+    vector<CacheStats> ring;
+    vector<uint64_t> ends;
+    vector<CacheStats> prev;
+    size_t head = 0, tail = 0, filled = 0;
+    bool stop = false;
+    mutex m;
+    condition_variable not_empty, not_full;
+    thread writer;
+};
+
+// Tamanho da próxima leitura a partir do acesso pos: com --interval os
+// blocos terminam nas fronteiras das janelas
+inline size_t window_read(size_t max, uint64_t pos, uint32_t interval) {
+    return interval ? static_cast<size_t>(min<uint64_t>(max, interval - pos % interval)) : max;
+}
+
+// Simulação de uma única configuração particionada por conjuntos. O
+// conjunto i fica no shard i % T; como T é potência de 2, cada shard é
+// exatamente uma CacheEngine(nsets / T, bsize * T, assoc) que recebe só os
+// endereços dos seus conjuntos. A thread principal decodifica e distribui
+// um bloco enquanto os shards simulam o anterior.
+//
+// A classificação capacidade/conflito depende do total global de linhas
+// válidas; enquanto a cache não enche, os shards registram as posições dos
+// preenchimentos e substituições e a classificação é refeita aqui.
+template<typename Addr = uint32_t>
+class PartitionedSim {
+public:
+    PartitionedSim(uint32_t nsets, uint32_t bsize, uint32_t assoc, Replacement repl,
+                   uint64_t seed, unsigned shards, WorkerPool& workers)
+        : n_shards(shards), pool(workers) {
+        offset_bits = ilog2(bsize);
+        total_lines = static_cast<uint64_t>(nsets) * assoc;
+        for (unsigned s = 0; s < shards; ++s) {
+            caches.emplace_back(new CacheEngine<Addr>(nsets / shards, bsize * shards, assoc, repl));
+            caches.back()->seed_random(seed, shards, s);
+        }
+        for (auto& q : queues) {
+            q.addrs.resize(shards);
+            q.pos.resize(shards);
+        }
+    }
+
+    void set_prefetch(uint32_t distance) {
+        for (auto& c : caches) c->prefetch_distance = distance;
+    }
+
+    // Distribui o bloco na fila livre; deve ser seguido de start()
+    void route(const Addr* addrs, size_t n) {
+        Queues& q = queues[cur];
+        bool with_pos = valid_lines != total_lines;
+        for (unsigned s = 0; s < n_shards; ++s) {
+            q.addrs[s].clear();
+            q.pos[s].clear();
+        }
+        uint32_t mask = n_shards - 1;
+        for (size_t k = 0; k < n; ++k) {
+            uint32_t s = static_cast<uint32_t>(addrs[k] >> offset_bits) & mask;
+            q.addrs[s].push_back(addrs[k]);
+            if (with_pos) q.pos[s].push_back(static_cast<uint32_t>(k));
+        }
+        q.full = !with_pos;
+    }
+
+    // Inicia a simulação do último bloco distribuído e libera a outra fila
+    void start() {
+        Queues* q = &queues[cur];
+        pool.start(n_shards, [this, q](size_t s) {
+            if (q->full)
+                caches[s]->access_batch(q->addrs[s].data(), q->addrs[s].size());
+            else
+                caches[s]->access_batch_logged(q->addrs[s].data(), q->addrs[s].size());
+        });
+        running = q;
+        cur ^= 1;
+    }
+
+    void wait() {
+        if (!running) return;
+        pool.wait();
+        if (!running->full) classify(*running);
+        running = nullptr;
+    }
+
+    CacheStats stats() const {
+        CacheStats st;
+        for (auto& c : caches) st.add(c->stats());
+        st.miss_capacity += capacity;
+        st.miss_conflict += conflict;
+        return st;
+    }
 
+private:
+    struct Queues {
+        vector<vector<Addr>> addrs;
+        vector<vector<uint32_t>> pos;
+        bool full = false;
+    };
+
+    void classify(const Queues& q) {
+        vector<uint32_t> fills;
+        for (unsigned s = 0; s < n_shards; ++s)
+            for (uint32_t k : caches[s]->log_fills) fills.push_back(q.pos[s][k]);
+
+        // Substituições após o preenchimento que completa a cache contam
+        // como capacidade (o bloco pode ter começado com a cache já cheia,
+        // pois route() decide com o total do bloco anterior)
+        uint64_t need = total_lines - valid_lines;
+        int64_t full_at = INT64_MAX;
+        if (need == 0) {
+            full_at = -1;
+        } else if (fills.size() >= need) {
+            nth_element(fills.begin(), fills.begin() + (need - 1), fills.end());
+            full_at = fills[need - 1];
+        }
+        valid_lines += fills.size();
+
+        for (unsigned s = 0; s < n_shards; ++s) {
+            for (uint32_t k : caches[s]->log_replacements) {
+                if (static_cast<int64_t>(q.pos[s][k]) > full_at)
+                    capacity++;
+                else
+                    conflict++;
+            }
+        }
+    }
+
+    unsigned n_shards;
+    uint32_t offset_bits;
+    WorkerPool& pool;
+    vector<unique_ptr<CacheEngine<Addr>>> caches;
+    Queues queues[2];
+    unsigned cur = 0;
+    Queues* running = nullptr;
+    uint64_t total_lines;
+    uint64_t valid_lines = 0;
+    uint64_t capacity = 0, conflict = 0;
+};
+
+// Simulação amostrada (--sample K): só 1 de cada K conjuntos é simulado,
+// escolhido por uma permutação embaralhada do índice para não seguir os
+// passos do trace. Os endereços dos outros conjuntos são descartados logo
+// depois da decodificação; os conjuntos amostrados são renumerados e
+// repartidos entre até MAX_GROUPS caches menores (o conjunto amostrado c vai
+// ao grupo c % G), o que preserva o comportamento de cada conjunto (só o
+// DRRIP duela dentro de cada grupo). A variação da taxa de misses entre os
+// grupos dá o intervalo de confiança.
+template<typename Addr = uint32_t>
+class SampledSim {
+public:
+    static constexpr uint32_t MAX_GROUPS = 32;
+
+    SampledSim(uint32_t nsets, uint32_t bsize, uint32_t assoc, Replacement repl,
+               uint64_t seed, uint32_t k)
+        : n_sets(nsets), rate(k) {
+        if (!is_pow2(k) || k > nsets)
+            throw invalid_argument("--sample deve ser potência de 2 e no máximo nsets: " + to_string(k));
+        offset_bits = ilog2(bsize);
+        index_bits = ilog2(nsets);
+        sample_bits = ilog2(k);
+        uint32_t sampled = nsets / k;
+        n_groups = min(MAX_GROUPS, sampled);
+        group_bits = ilog2(n_groups);
+        local_bits = index_bits - sample_bits - group_bits;
+        // Os fluxos RANDOM/BRRIP de cada conjunto amostrado seguem o índice
+        // original dele, como na simulação completa
+        const uint32_t local_sets = sampled / n_groups;
+        vector<vector<uint32_t>> global(n_groups, vector<uint32_t>(local_sets));
+        for (uint64_t i = 0; i < nsets; ++i) {
+            uint32_t p = mix(static_cast<uint32_t>(i));
+            if (p & (k - 1)) continue;
+            uint32_t c = p >> sample_bits;
+            global[c & (n_groups - 1)][c >> group_bits] = static_cast<uint32_t>(i);
+        }
+        for (uint32_t g = 0; g < n_groups; ++g) {
+            caches.emplace_back(new CacheEngine<Addr>(local_sets, bsize, assoc, repl));
+            caches.back()->seed_random(seed, move(global[g]));
+        }
+        buffers.resize(n_groups);
+    }
+
+    void set_prefetch(uint32_t distance) {
+        for (auto& c : caches) c->prefetch_distance = distance;
+    }
+
+    void access_batch(const Addr* addrs, size_t n) {
+        total += n;
+        for (auto& b : buffers) b.clear();
+        const uint32_t index_mask = (uint32_t(1) << index_bits) - 1;
+        const uint32_t sample_mask = rate - 1, group_mask = n_groups - 1;
+        const Addr offset_mask = (Addr(1) << offset_bits) - 1;
+        for (size_t k = 0; k < n; ++k) {
+            Addr a = addrs[k];
+            uint32_t p = mix(static_cast<uint32_t>(a >> offset_bits) & index_mask);
+            if (p & sample_mask) continue;
+            uint32_t c = p >> sample_bits;
+            Addr remapped = ((a >> (offset_bits + index_bits)) << (offset_bits + local_bits)) |
+                            (static_cast<Addr>(c >> group_bits) << offset_bits) | (a & offset_mask);
+            buffers[c & group_mask].push_back(remapped);
+        }
+        for (uint32_t g = 0; g < n_groups; ++g)
+            caches[g]->access_batch(buffers[g].data(), buffers[g].size());
+    }
+
+    CacheStats stats() const {
+        CacheStats st;
+        for (auto& c : caches) st.add(c->stats());
+        return st;
+    }
+
+    // Semiamplitude do IC de 95% da taxa de misses: estimador de razão com
+    // os grupos como conglomerados e correção pela fração amostrada 1/K
+    double miss_rate_ci() const {
+        if (n_groups < 2) return NAN;
+        double a = 0, m = 0;
+        for (auto& c : caches) {
+            a += c->accesses;
+            m += c->misses;
+        }
+        if (a == 0) return 0;
+        double r = m / a, s2 = 0;
+        for (auto& c : caches) {
+            double d = c->misses - r * c->accesses;
+            s2 += d * d;
+        }
+        s2 /= n_groups - 1;
+        double mean = a / n_groups;
+        return 1.96 * sqrt((1.0 - 1.0 / rate) * s2 / n_groups) / mean;
+    }
+
+    // Sem a divisão capacidade/conflito: cada grupo só vê os próprios
+    // conjuntos, e a divisão dele não é comparável com a da simulação completa
+    void print(bool modo) const {
+        CacheStats st = stats();
+        auto r = [](uint64_t n, uint64_t base) -> double {
+            return (base == 0) ? 0.0 : static_cast<double>(n) / base;
+        };
+        double rate_est = r(st.misses, st.accesses);
+        double ci = miss_rate_ci();
         if (modo) {
-        // Modo compacto (flag = 1)
-        printf("%u %.4lf %.4lf %.4lf %.4lf %.4lf\n",
-               accesses, r(hits, accesses), r(misses, accesses),
-               r(miss_compulsory, misses),
-               r(miss_capacity, misses),
-               r(miss_conflict, misses));
-        } else {
-        // Modo formatado (flag = 0)
+            printf("%" PRIu64 " %.4lf %.4lf %.4lf\n", st.accesses, r(st.hits, st.accesses), rate_est,
+                   r(st.miss_compulsory, st.misses));
+            printf("amostra %u %" PRIu64 " %" PRIu64 " %.4lf %.4lf\n", rate, st.accesses, total,
+                   rate_est, ci);
+            return;
+        }
         printf("==================================================================\n");
-        printf("Total de acessos:            %u\n", accesses);
-        printf("Taxa de hits:                %.2lf%%\n", 100.0 * r(hits, accesses));
-        printf("Taxa de misses:              %.2lf%%\n", 100.0 * r(misses, accesses));
-        printf("- Misses compulsórios:       %.2lf%%\n", 100.0 * r(miss_compulsory, misses));
-        printf("- Misses por capacidade:     %.2lf%%\n", 100.0 * r(miss_capacity, misses));
-        printf("- Misses por conflito:       %.2lf%%\n", 100.0 * r(miss_conflict, misses));
+        printf("Total de acessos:            %" PRIu64 "\n", st.accesses);
+        printf("Taxa de hits:                %.2lf%%\n", 100.0 * r(st.hits, st.accesses));
+        printf("Taxa de misses:              %.2lf%%\n", 100.0 * rate_est);
+        printf("- Misses compulsórios:       %.2lf%%\n", 100.0 * r(st.miss_compulsory, st.misses));
         printf("==================================================================\n");
+        printf("Amostragem: 1 de %u conjuntos (%u de %u), %" PRIu64 " de %" PRIu64 " acessos simulados\n",
+               rate, n_sets / rate, n_sets, st.accesses, total);
+        if (isnan(ci))
+            printf("Taxa de misses estimada:     %.2lf%% (IC indisponível com um só conjunto)\n",
+                   100.0 * rate_est);
+        else
+            printf("Taxa de misses estimada:     %.2lf%% ± %.2lf%% (IC 95%%)\n", 100.0 * rate_est,
+                   100.0 * ci);
+    }
+
+private:
+    // Bijeção em index_bits bits: multiplicações ímpares levam os bits
+    // baixos para cima e os xor-shifts trazem os altos para baixo
+    uint32_t mix(uint32_t s) const {
+        const uint32_t mask = (uint32_t(1) << index_bits) - 1;
+        const uint32_t half = (index_bits + 1) / 2;
+        s = (s * 0x9E3779B1u) & mask;
+        s ^= s >> half;
+        s = (s * 0x85EBCA6Bu) & mask;
+        s ^= s >> half;
+        return s;
+    }
+
+    uint32_t n_sets, rate;
+    uint32_t offset_bits, index_bits, sample_bits, group_bits, local_bits;
+    uint32_t n_groups;
+    vector<unique_ptr<CacheEngine<Addr>>> caches;
+    vector<vector<Addr>> buffers;
+    uint64_t total = 0;
+};
+
+// Política de inclusão entre níveis da hierarquia
+enum class Inclusion { NINE, INCLUSIVE, EXCLUSIVE };
+
+// Hierarquia L1..Ln num único passe: só os misses de um nível descem ao
+// seguinte. Em NINE cada nível processa em bloco os misses do anterior. Na
+// exclusiva a L1 não depende dos níveis de baixo e roda em bloco; cada miss
+// dela busca (e retira) o bloco nos níveis inferiores, e a vítima da L1 desce
+// em cascata. Na inclusiva as invalidações reversas alteram os níveis de cima
+// no meio do bloco, então os níveis avançam juntos, acesso a acesso.
+template<typename Addr = uint32_t>
+class Hierarchy {
+public:
+    explicit Hierarchy(Inclusion inc) : inclusion(inc) {}
+
+    CacheEngine<Addr>& add_level(uint32_t nsets, uint32_t bsize, uint32_t assoc, Replacement repl) {
+        levels.emplace_back(new CacheEngine<Addr>(nsets, bsize, assoc, repl));
+        return *levels.back();
+    }
+
+    void access_batch(const Addr* addrs, size_t n) {
+        switch (inclusion) {
+            case Inclusion::NINE: run_nine(addrs, n); break;
+            case Inclusion::EXCLUSIVE: run_exclusive(addrs, n); break;
+            case Inclusion::INCLUSIVE: run_inclusive(addrs, n); break;
+        }
+    }
+
+    vector<unique_ptr<CacheEngine<Addr>>> levels;
+
+private:
+    // Endereços dos misses registrados no log, na ordem do bloco
+    static void collect_misses(const CacheEngine<Addr>& c, const Addr* addrs, vector<Addr>& out) {
+        out.clear();
+        size_t f = 0, r = 0;
+        const vector<uint32_t>& fills = c.log_fills;
+        const vector<uint32_t>& reps = c.log_replacements;
+        while (f < fills.size() || r < reps.size()) {
+            if (r == reps.size() || (f < fills.size() && fills[f] < reps[r]))
+                out.push_back(addrs[fills[f++]]);
+            else
+                out.push_back(addrs[reps[r++]]);
+        }
+    }
+
+    void run_nine(const Addr* addrs, size_t n) {
+        const Addr* cur = addrs;
+        for (size_t i = 0; i + 1 < levels.size() && n > 0; ++i) {
+            CacheEngine<Addr>& c = *levels[i];
+            c.access_batch_logged(cur, n);
+            c.classify_logged(cur, n);
+            vector<Addr>& out = stream[i & 1];
+            collect_misses(c, cur, out);
+            cur = out.data();
+            n = out.size();
+        }
+        if (n > 0) levels.back()->access_batch(cur, n);
+    }
+
+    void run_exclusive(const Addr* addrs, size_t n) {
+        CacheEngine<Addr>& l1 = *levels[0];
+        l1.access_batch_logged(addrs, n);
+        l1.classify_logged(addrs, n);
+        size_t f = 0, r = 0;
+        const vector<uint32_t>& fills = l1.log_fills;
+        const vector<uint32_t>& reps = l1.log_replacements;
+        while (f < fills.size() || r < reps.size()) {
+            if (r == reps.size() || (f < fills.size() && fills[f] < reps[r])) {
+                descend(addrs[fills[f++]], false, 0);
+            } else {
+                descend(addrs[reps[r]], true, l1.log_victims[r]);
+                r++;
+            }
+        }
+    }
+
+    void descend(Addr address, bool has_victim, Addr victim) {
+        for (size_t i = 1; i < levels.size(); ++i)
+            if (levels[i]->lookup(address, true)) break;
+        // Cada nível guarda a vítima que recebe e repassa a que expulsa
+        for (size_t i = 1; has_victim && i < levels.size(); ++i)
+            has_victim = levels[i]->install(victim, victim);
+    }
+
+    void run_inclusive(const Addr* addrs, size_t n) {
+        for (size_t k = 0; k < n; ++k) {
+            Addr address = addrs[k];
+            size_t missed = 0;
+            while (missed < levels.size() && !levels[missed]->lookup(address, false))
+                missed++;
+            // Preenche de baixo para cima; o bloco expulso de um nível é
+            // invalidado nos níveis acima dele
+            for (size_t i = missed; i-- > 0;) {
+                Addr victim;
+                if (levels[i]->install(address, victim))
+                    for (size_t j = 0; j < i; ++j) levels[j]->invalidate(victim);
+            }
         }
     }
+
+    Inclusion inclusion;
+    vector<Addr> stream[2];
 };
 
-uint32_t swap_endian(uint32_t value) {
-    return ((value >> 24) & 0xFF) |
-           ((value >> 8)  & 0xFF00) |
-           ((value << 8)  & 0xFF0000) |
-           ((value << 24) & 0xFF000000);
-}
+// Distâncias de pilha (Mattson) para LRU: a distância de um acesso é o
+// número de blocos distintos do mesmo conjunto usados desde o último acesso
+// ao bloco, e ele é hit em toda cache LRU com assoc maior que ela.
+// Cada conjunto marca numa árvore de Fenwick, sobre o seu tempo local, o
+// instante do último acesso de cada bloco; quando o tempo esgota a árvore
+// é compactada para os blocos vivos. Com nsets = 1 a curva cobre todas as
+// capacidades de uma cache totalmente associativa.
+template<typename Addr = uint32_t>
+class StackDistance {
+public:
+    uint32_t n_sets, block_size, max_assoc;
+    uint32_t offset_bits, index_mask;
+    uint64_t accesses = 0;
+    uint64_t cold = 0;
+    vector<uint64_t> hist;   // hist[d] = acessos com distância d
+
+    StackDistance(uint32_t ns, uint32_t bs, uint32_t max_a)
+        : n_sets(ns), block_size(bs), max_assoc(max_a), sets(ns) {
+        if (!is_pow2(ns))
+            throw invalid_argument("nsets deve ser potência de 2: " + to_string(ns));
+        if (!is_pow2(bs))
+            throw invalid_argument("bsize deve ser potência de 2: " + to_string(bs));
+        offset_bits = ilog2(bs);
+        index_mask = ns - 1;
+    }
+
+    void access_batch(const Addr* addrs, size_t n) {
+        for (size_t k = 0; k < n; ++k) {
+            Addr block = addrs[k] >> offset_bits;
+            SetState& st = sets[static_cast<uint32_t>(block) & index_mask];
+            if (st.time == st.blocks.size()) compact(st);
+
+            uint32_t t = st.time++;
+            bool inserted;
+            uint32_t* last = last_use.insert(block, t, inserted);
+            if (inserted) {
+                cold++;
+            } else {
+                uint32_t p = *last;
+                uint32_t d = prefix(st, t) - prefix(st, p + 1);
+                add(st, p, -1);
+                if (d >= hist.size()) hist.resize(d + 1, 0);
+                hist[d]++;
+                *last = t;
+            }
+            add(st, t, 1);
+            st.blocks[t] = block;
+        }
+        accesses += n;
+    }
+
+    // Uma linha por associatividade, de 1 até max_assoc (0 = até só restarem
+    // os misses compulsórios)
+    void print(bool modo) const {
+        // Com max_assoc 0 a curva para na primeira associatividade em que só
+        // restam os compulsórios (ao menos uma linha, mesmo sem reúso)
+        uint32_t top = max_assoc ? max_assoc : max<uint32_t>(1, static_cast<uint32_t>(hist.size()));
+        uint64_t beyond = accesses - cold;   // acessos com distância >= a
+        if (!modo) {
+            printf("==================================================================\n");
+            printf("Curva LRU: %u conjuntos, blocos de %u bytes, %" PRIu64 " acessos\n",
+                   n_sets, block_size, accesses);
+            printf("Misses compulsórios:         %" PRIu64 "\n", cold);
+        }
+        for (uint32_t a = 1; a <= top; ++a) {
+            if (a - 1 < hist.size()) beyond -= hist[a - 1];
+            uint64_t m = cold + beyond;
+            double hit_rate = accesses ? static_cast<double>(accesses - m) / accesses : 0.0;
+            double miss_rate = accesses ? static_cast<double>(m) / accesses : 0.0;
+            if (modo) {
+                printf("%u %" PRIu64 " %.4lf %.4lf\n", a, accesses, hit_rate, miss_rate);
+            } else {
+                printf("assoc %6u (%12" PRIu64 " bytes): hits %6.2lf%%  misses %6.2lf%%\n", a,
+                       static_cast<uint64_t>(n_sets) * a * block_size,
+                       100.0 * hit_rate, 100.0 * miss_rate);
+            }
+        }
+        if (!modo)
+            printf("==================================================================\n");
+    }
+
+private:
+    struct SetState {
+        vector<uint32_t> tree;     // Fenwick 1-based sobre o tempo local
+        vector<Addr> blocks;       // bloco acessado em cada instante
+        uint32_t time = 0;
+    };
+
+    static uint32_t prefix(const SetState& st, uint32_t end) {
+        uint32_t sum = 0;
+        for (uint32_t i = end; i > 0; i &= i - 1) sum += st.tree[i];
+        return sum;
+    }
+
+    static void add(SetState& st, uint32_t pos, int32_t delta) {
+        for (size_t i = pos + 1; i < st.tree.size(); i += i & (~i + 1))
+            st.tree[i] += delta;
+    }
+
+    // Renumera os blocos vivos do conjunto como 0..vivos-1, na mesma ordem,
+    // e dobra a capacidade em relação a eles
+    void compact(SetState& st) {
+        vector<Addr> live;
+        for (uint32_t t = 0; t < st.time; ++t) {
+            uint32_t* last = last_use.find(st.blocks[t]);
+            if (last && *last == t) {
+                *last = static_cast<uint32_t>(live.size());
+                live.push_back(st.blocks[t]);
+            }
+        }
+        size_t cap = max<size_t>(8, live.size() * 2);
+        st.blocks.assign(cap, 0);
+        copy(live.begin(), live.end(), st.blocks.begin());
+        st.tree.assign(cap + 1, 0);
+        for (size_t i = 1; i <= cap; ++i) {
+            if (i <= live.size()) st.tree[i] += 1;
+            size_t j = i + (i & (~i + 1));
+            if (j <= cap) st.tree[j] += st.tree[i];
+        }
+        st.time = static_cast<uint32_t>(live.size());
+    }
+
+    vector<SetState> sets;
+    FlatMap<Addr, uint32_t> last_use;
+};
 
 Replacement parse_replacement(const string& r) {
     if (r == "L") return Replacement::LRU;
     if (r == "F") return Replacement::FIFO;
     if (r == "R") return Replacement::RANDOM;
+    if (r == "P") return Replacement::PLRU_TREE;
+    if (r == "M") return Replacement::PLRU_BIT;
+    if (r == "S") return Replacement::SRRIP;
+    if (r == "B") return Replacement::BRRIP;
+    if (r == "D") return Replacement::DRRIP;
     throw invalid_argument("Invalid replacement policy: " + r);
 }
 
-void usage(const string& prog) {
-    cout << "\nUsage: " << prog << " [nsets] [bsize] [assoc] [R|L|F] [0|1] [input_file]\n" << endl;
+const char* replacement_name(Replacement r) {
+    switch (r) {
+        case Replacement::LRU: return "L";
+        case Replacement::FIFO: return "F";
+        case Replacement::PLRU_TREE: return "P";
+        case Replacement::PLRU_BIT: return "M";
+        case Replacement::SRRIP: return "S";
+        case Replacement::BRRIP: return "B";
+        case Replacement::DRRIP: return "D";
+        case Replacement::RANDOM: break;
+    }
+    return "R";
 }
 
-int main(int argc, char** argv) {
-    srand(0);
+Inclusion parse_inclusion(const string& s) {
+    if (s == "nine") return Inclusion::NINE;
+    if (s == "inclusive") return Inclusion::INCLUSIVE;
+    if (s == "exclusive") return Inclusion::EXCLUSIVE;
+    throw invalid_argument("Política de inclusão inválida: " + s);
+}
 
-    if (argc != 7) {
-        usage(argv[0]);
-        return 1;
+uint64_t parse_u64(const string& s, const char* what) {
+    size_t end = 0;
+    unsigned long long v = 0;
+    try {
+        v = stoull(s, &end);
+    } catch (const exception&) {
+        end = 0;
     }
+    if (end == 0 || end != s.size())
+        throw invalid_argument(string("Valor inválido para ") + what + ": " + s);
+    return v;
+}
+
+uint32_t parse_u32(const string& s, const char* what) {
+    uint64_t v = parse_u64(s, what);
+    if (v > UINT32_MAX)
+        throw invalid_argument(string("Valor inválido para ") + what + ": " + s);
+    return static_cast<uint32_t>(v);
+}
 
-    uint32_t nsets = stoul(argv[1]);
-    uint32_t bsize = stoul(argv[2]);
-    uint32_t assoc = stoul(argv[3]);
+struct CacheConfig {
+    uint32_t nsets, bsize, assoc;
     Replacement repl;
+};
+
+CacheConfig make_config(const string& ns, const string& bs, const string& a, const string& r) {
+    return CacheConfig{parse_u32(ns, "nsets"), parse_u32(bs, "bsize"), parse_u32(a, "assoc"),
+                       parse_replacement(r)};
+}
+
+// Configuração no formato nsets:bsize:assoc:R (ou separada por espaços)
+CacheConfig parse_config(const string& spec) {
+    vector<string> f;
+    string cur;
+    for (char ch : spec) {
+        if (ch == ':' || ch == ' ' || ch == '\t' || ch == '\r') {
+            if (!cur.empty()) f.push_back(cur);
+            cur.clear();
+        } else {
+            cur += ch;
+        }
+    }
+    if (!cur.empty()) f.push_back(cur);
+    if (f.size() != 4)
+        throw invalid_argument("Configuração inválida: " + spec);
+    return make_config(f[0], f[1], f[2], f[3]);
+}
+
+// Arquivo de configurações: uma por linha; linhas vazias e '#' são ignoradas
+void read_config_file(const string& filename, vector<CacheConfig>& out) {
+    FILE* f = fopen(filename.c_str(), "r");
+    if (!f)
+        throw runtime_error("Erro ao abrir arquivo: " + filename);
+    char buf[256];
+    while (fgets(buf, sizeof(buf), f)) {
+        string line(buf);
+        size_t hash = line.find('#');
+        if (hash != string::npos) line.erase(hash);
+        while (!line.empty() && isspace(static_cast<unsigned char>(line.back()))) line.pop_back();
+        if (line.find_first_not_of(" \t") == string::npos) continue;
+        out.push_back(parse_config(line));
+    }
+    fclose(f);
+}
+
+struct Options {
+    vector<CacheConfig> configs;
+    bool sweep = false;
+    unsigned threads = 1;
+    bool partition = false;
+    bool lru_curve = false;
+    bool exact_3c = false;
+    uint64_t seed = 0;
+    uint32_t curve_nsets = 0, curve_bsize = 0, curve_max = 0;
+    // Níveis abaixo da configuração posicional (L2, L3, ...)
+    vector<CacheConfig> levels;
+    Inclusion inclusion = Inclusion::NINE;
+    TraceFormat format = TraceFormat::ADDR;
+    Compression compression = Compression::AUTO;
+    uint32_t prefetch = 0;
+    uint32_t bench = 0;      // acessos por trace sintético; 0 = sem --bench
+    bool profile = false;
+    uint32_t interval = 0;   // acessos por janela; 0 = só totais
+    string interval_out = "-";
+    // Snapshot do estado (--checkpoint), a cada checkpoint_every acessos e
+    // no fim; resume = snapshot de partida
+    string checkpoint, resume;
+    uint32_t checkpoint_every = 0;
+    // Aquecimento: acessos iniciais e/ou trace prévio que não entram nas estatísticas
+    uint64_t warmup = 0;
+    string warmup_trace;
+    uint32_t sample = 0;     // 1 de cada sample conjuntos; 0 = simulação completa
+    bool collapse_runs = false;
+    string convert;          // grava o trace no formato nativo em vez de simular
+    // --serve: o trace vem do anel compartilhado filename, de ring_size registros
+    bool serve = false;
+    uint64_t ring_size = 1 << 20;
+    bool write_back = true, write_allocate = true;
+    bool compact = false;
+    string filename;
+};
+
+// Retorna false quando a linha de comando não tem a forma esperada
+bool parse_args(int argc, char** argv, Options& opt) {
+    vector<string> pos;
+    string serve_name;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--partition") {
+            opt.partition = true;
+        } else if (arg == "--exact-3c") {
+            opt.exact_3c = true;
+        } else if (arg == "--profile") {
+            opt.profile = true;
+        } else if (arg == "--collapse-runs") {
+            opt.collapse_runs = true;
+        } else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            if (i + 1 >= argc) return false;
+            string val = argv[++i];
+            if (arg == "--config") {
+                opt.configs.push_back(parse_config(val));
+                opt.sweep = true;
+            } else if (arg == "--sweep") {
+                read_config_file(val, opt.configs);
+                opt.sweep = true;
+            } else if (arg == "--lru-curve") {
+                vector<string> f;
+                size_t start = 0, colon;
+                while ((colon = val.find(':', start)) != string::npos) {
+                    f.push_back(val.substr(start, colon - start));
+                    start = colon + 1;
+                }
+                f.push_back(val.substr(start));
+                if (f.size() != 3)
+                    throw invalid_argument("--lru-curve espera nsets:bsize:max_assoc");
+                opt.curve_nsets = parse_u32(f[0], "nsets");
+                opt.curve_bsize = parse_u32(f[1], "bsize");
+                opt.curve_max = parse_u32(f[2], "max_assoc");
+                opt.lru_curve = true;
+            } else if (arg == "--seed") {
+                size_t end = 0;
+                try {
+                    opt.seed = stoull(val, &end, 0);
+                } catch (const exception&) {
+                    end = 0;
+                }
+                if (end == 0 || end != val.size())
+                    throw invalid_argument("Valor inválido para --seed: " + val);
+            } else if (arg == "--level") {
+                opt.levels.push_back(parse_config(val));
+            } else if (arg == "--inclusion") {
+                opt.inclusion = parse_inclusion(val);
+            } else if (arg == "--format") {
+                if (val == "addr")
+                    opt.format = TraceFormat::ADDR;
+                else if (val == "rw")
+                    opt.format = TraceFormat::RW;
+                else if (val == "addr64")
+                    opt.format = TraceFormat::ADDR64;
+                else if (val == "rw64")
+                    opt.format = TraceFormat::RW64;
+                else
+                    throw invalid_argument("Formato de trace inválido: " + val);
+            } else if (arg == "--compression") {
+                auto it = find_if(begin(COMPRESSION_NAMES), end(COMPRESSION_NAMES),
+                                  [&](const char* c) { return val == c; });
+                if (it == end(COMPRESSION_NAMES))
+                    throw invalid_argument("Compressão inválida: " + val);
+                opt.compression = static_cast<Compression>(it - begin(COMPRESSION_NAMES));
+            } else if (arg == "--write") {
+                if (val != "wb" && val != "wt")
+                    throw invalid_argument("--write espera wb ou wt: " + val);
+                opt.write_back = val == "wb";
+            } else if (arg == "--write-miss") {
+                if (val != "wa" && val != "nwa")
+                    throw invalid_argument("--write-miss espera wa ou nwa: " + val);
+                opt.write_allocate = val == "wa";
+            } else if (arg == "--bench") {
+                opt.bench = parse_u32(val, "--bench");
+                if (opt.bench == 0)
+                    throw invalid_argument("--bench espera um número de acessos maior que zero");
+            } else if (arg == "--interval") {
+                opt.interval = parse_u32(val, "--interval");
+                if (opt.interval == 0)
+                    throw invalid_argument("--interval espera um número de acessos maior que zero");
+            } else if (arg == "--interval-out") {
+                opt.interval_out = val;
+            } else if (arg == "--checkpoint") {
+                opt.checkpoint = val;
+            } else if (arg == "--checkpoint-every") {
+                opt.checkpoint_every = parse_u32(val, "--checkpoint-every");
+            } else if (arg == "--resume") {
+                opt.resume = val;
+            } else if (arg == "--warmup") {
+                opt.warmup = parse_u64(val, "--warmup");
+            } else if (arg == "--warmup-trace") {
+                opt.warmup_trace = val;
+            } else if (arg == "--serve") {
+                opt.serve = true;
+                serve_name = val;
+            } else if (arg == "--ring-size") {
+                opt.ring_size = parse_u64(val, "--ring-size");
+                if (opt.ring_size == 0 || (opt.ring_size & (opt.ring_size - 1)) != 0)
+                    throw invalid_argument("--ring-size deve ser potência de 2: " + val);
+            } else if (arg == "--convert") {
+                opt.convert = val;
+            } else if (arg == "--sample") {
+                opt.sample = parse_u32(val, "--sample");
+                if (opt.sample == 0)
+                    throw invalid_argument("--sample espera uma taxa maior que zero");
+            } else if (arg == "--prefetch") {
+                opt.prefetch = parse_u32(val, "--prefetch");
+            } else if (arg == "--threads") {
+                opt.threads = parse_u32(val, "--threads");
+                if (opt.threads == 0)
+                    opt.threads = max(1u, thread::hardware_concurrency());
+            } else {
+                throw invalid_argument("Opção desconhecida: " + arg);
+            }
+        } else {
+            pos.push_back(arg);
+        }
+    }
+    // O anel ocupa o lugar do arquivo de entrada
+    if (opt.serve) {
+        if (!opt.resume.empty())
+            throw invalid_argument("--serve não combina com --resume: o anel não pode ser reposicionado");
+        if (opt.compression != Compression::AUTO)
+            throw invalid_argument("--serve não combina com --compression: o anel traz registros crus");
+        pos.push_back(serve_name);
+    }
+
+    if (trace_has_ops(opt.format) &&
+        (opt.partition || opt.lru_curve || opt.exact_3c || !opt.levels.empty()))
+        throw invalid_argument("--format rw/rw64 não combina com --partition/--lru-curve/--exact-3c/--level");
+    if (!opt.levels.empty() && (opt.sweep || opt.partition || opt.lru_curve))
+        throw invalid_argument("--level não pode ser combinado com --config/--sweep/--partition/--lru-curve");
+    if (opt.checkpoint_every && opt.checkpoint.empty())
+        throw invalid_argument("--checkpoint-every exige --checkpoint");
+    if ((!opt.checkpoint.empty() || !opt.resume.empty()) &&
+        (opt.partition || opt.lru_curve || opt.exact_3c || !opt.levels.empty()))
+        throw invalid_argument("--checkpoint/--resume não combinam com --partition/--lru-curve/--exact-3c/--level");
+    bool warmup = opt.warmup || !opt.warmup_trace.empty();
+    if (warmup && (opt.partition || opt.lru_curve || !opt.levels.empty()))
+        throw invalid_argument("--warmup/--warmup-trace não combinam com --partition/--lru-curve/--level");
+    if (!opt.warmup_trace.empty() && !opt.resume.empty())
+        throw invalid_argument("--warmup-trace não combina com --resume: o checkpoint já traz o estado aquecido");
+    if (opt.sample &&
+        (opt.partition || opt.lru_curve || opt.exact_3c || !opt.levels.empty() || opt.threads > 1 ||
+         trace_has_ops(opt.format) || opt.interval || !opt.checkpoint.empty() ||
+         !opt.resume.empty() || warmup))
+        throw invalid_argument("--sample só combina com --config/--sweep/--seed/--prefetch/--profile/--format addr64");
+    if (!opt.convert.empty()) {
+        if (opt.bench || opt.lru_curve || opt.sweep || opt.partition || opt.exact_3c ||
+            !opt.levels.empty() || opt.profile || opt.interval || !opt.checkpoint.empty() ||
+            !opt.resume.empty() || warmup || opt.sample || opt.collapse_runs)
+            throw invalid_argument("--convert só combina com --format");
+        if (pos.size() != 1) return false;
+        opt.filename = pos[0];
+        return true;
+    }
+    if (opt.collapse_runs && trace_has_ops(opt.format))
+        throw invalid_argument("--collapse-runs não combina com --format rw/rw64: escritas repetidas alteram o estado");
+    if (opt.collapse_runs && (opt.partition || opt.lru_curve || !opt.levels.empty() || opt.sample))
+        throw invalid_argument("--collapse-runs não combina com --partition/--lru-curve/--level/--sample");
+    if (opt.bench) {
+        if (opt.collapse_runs || opt.lru_curve || opt.partition || opt.exact_3c || !opt.levels.empty() ||
+            opt.profile || opt.interval || !opt.checkpoint.empty() || !opt.resume.empty() ||
+            warmup || opt.sample || opt.format != TraceFormat::ADDR)
+            throw invalid_argument("--bench só combina com --config/--sweep/--seed/--prefetch");
+        return pos.empty();
+    }
+    if (opt.lru_curve) {
+        if (opt.sweep || opt.partition || opt.interval)
+            throw invalid_argument("--lru-curve não pode ser combinado com --config/--sweep/--partition/--interval");
+        if (pos.size() != 2) return false;
+        opt.compact = pos[0] != "0";
+        opt.filename = pos[1];
+        return true;
+    }
+    if (opt.sweep) {
+        if (pos.size() != 2) return false;
+        if (opt.configs.empty())
+            throw invalid_argument("Nenhuma configuração informada");
+    } else {
+        if (pos.size() != 6) return false;
+        opt.configs.push_back(make_config(pos[0], pos[1], pos[2], pos[3]));
+        pos.erase(pos.begin(), pos.begin() + 4);
+    }
+    if (!opt.levels.empty() && opt.inclusion != Inclusion::NINE) {
+        if (opt.exact_3c)
+            throw invalid_argument("--exact-3c só está disponível com --inclusion nine");
+        for (const CacheConfig& c : opt.levels)
+            if (c.bsize != opt.configs[0].bsize)
+                throw invalid_argument("Hierarquia inclusiva/exclusiva exige o mesmo bsize em todos os níveis");
+    }
+    if (trace_addr_bits(opt.format) == 32) {
+        for (const vector<CacheConfig>* list : {&opt.configs, &opt.levels})
+            for (const CacheConfig& c : *list)
+                if ((uint64_t)c.nsets * c.bsize * c.assoc > UINT32_MAX)
+                    throw invalid_argument("Erro: cache maior que espaço de endereçamento 32-bit");
+    }
+    if (opt.partition && opt.configs.size() != 1)
+        throw invalid_argument("--partition simula uma única configuração");
+    if (opt.partition && opt.configs[0].repl == Replacement::DRRIP)
+        throw invalid_argument("DRRIP compartilha o contador de seleção entre conjuntos e não combina com --partition");
+    if (opt.partition && opt.exact_3c)
+        throw invalid_argument("--exact-3c precisa da ordem global do trace e não combina com --partition");
+    opt.compact = pos[0] != "0";
+    opt.filename = pos[1];
+    return true;
+}
+
+void usage(const string& prog) {
+    cout << "\nUsage: " << prog << " [nsets] [bsize] [assoc] [R|L|F|P|M|S|B|D] [0|1] [input_file]\n"
+         << "       " << prog << " --config nsets:bsize:assoc:R [--config ...] [0|1] [input_file]\n"
+         << "       " << prog << " --sweep configs.txt [0|1] [input_file]\n"
+         << "       " << prog << " --lru-curve nsets:bsize:max_assoc [0|1] [input_file]\n"
+         << "       " << prog << " --bench accesses [--config ... | --sweep configs.txt]\n"
+         << "       " << prog << " --convert output_file [--format ...] [input_file]\n"
+         << "\nOptions:\n"
+         << "  --threads N   simulate the configurations on N threads (0 = all cores)\n"
+         << "  --partition   split a single configuration by set index across the threads\n"
+         << "  --exact-3c    classify misses against a fully-associative LRU shadow cache\n"
+         << "  --seed N      seed for RANDOM replacement (default 0)\n"
+         << "  --prefetch N  prefetch the set of the access N ahead (default 0 = off)\n"
+         << "  --interval N  also print hit/miss/3C rates of every window of N accesses as CSV\n"
+         << "  --interval-out FILE\n"
+         << "                write the --interval CSV to FILE instead of stdout\n"
+         << "  --checkpoint FILE\n"
+         << "                save the cache state to FILE at the end of the run\n"
+         << "  --checkpoint-every N\n"
+         << "                also save it every N accesses\n"
+         << "  --resume FILE restore the state saved in FILE and continue the trace from there\n"
+         << "  --warmup N    simulate the first N accesses without counting them in the statistics\n"
+         << "  --warmup-trace FILE\n"
+         << "                warm the caches with FILE (same format) before the input trace\n"
+         << "  --sample K    simulate only 1 in K sets (K a power of two) and estimate the miss rate\n"
+         << "  --collapse-runs\n"
+         << "                drop repeated accesses to the same block before simulating them\n"
+         << "                (counted as hits; exact, not available with --format rw)\n"
+         << "  --serve NAME  read the trace from the shared-memory ring NAME, fed by a tracer\n"
+         << "                through cache_sim_shm.h (replaces input_file)\n"
+         << "  --ring-size N capacity of the --serve ring in records (power of two, default 2^20)\n"
+         << "  --profile     report time spent in trace I/O, endian conversion and simulation,\n"
+         << "                plus hardware counters where available\n"
+         << "  --level nsets:bsize:assoc:R\n"
+         << "                add a cache level below the previous one (repeatable)\n"
+         << "  --inclusion nine|inclusive|exclusive\n"
+         << "                inclusion policy between levels (default nine)\n"
+         << "  --format addr|rw|addr64|rw64\n"
+         << "                trace records: big-endian address (default), op byte + address,\n"
+         << "                or the same with 8-byte addresses\n"
+         << "  --compression auto|none|gzip|zstd|lz4|xz|bzip2\n"
+         << "                detect compressed traces by their header (default), read them\n"
+         << "                as-is, or decompress them with the given tool\n"
+         << "  --write wb|wt\n"
+         << "                write-back (default) or write-through, with --format rw\n"
+         << "  --write-miss wa|nwa\n"
+         << "                write-allocate (default) or no-write-allocate, with --format rw\n" << endl;
+}
+
+// Perfil do --profile (nullptr sem ele); counters quando a simulação
+// roda na thread principal
+unique_ptr<Profile> make_profile(const Options& opt, bool counters) {
+    if (!opt.profile) return nullptr;
+    unique_ptr<Profile> p(new Profile);
+    if (counters) p->perf.reset(new PerfCounters);
+    return p;
+}
+
+// Janelas do --interval (nullptr sem ele) para as streams caches simuladas
+unique_ptr<IntervalWriter> make_interval(const Options& opt, size_t streams, bool rw) {
+    if (!opt.interval) return nullptr;
+    return unique_ptr<IntervalWriter>(new IntervalWriter(opt.interval_out, streams, rw));
+}
+
+template<typename Addr>
+void run_lru_curve(const Options& opt) {
+    StackDistance<Addr> sd(opt.curve_nsets, opt.curve_bsize, opt.curve_max);
+    unique_ptr<Profile> prof = make_profile(opt, true);
+    TraceReader trace(opt.filename, opt.format, opt.serve ? opt.ring_size : 0, opt.compression);
+    trace.set_profile(prof.get());
+    vector<Addr> block(TraceReader::BLOCK);
+    size_t n;
+    while ((n = trace.read(block.data(), block.size())) > 0) {
+        PhaseTimer t = profile_phase(prof.get(), &Profile::sim, true);
+        sd.access_batch(block.data(), n);
+    }
+    sd.print(opt.compact);
+    if (prof) prof->print(opt.compact);
+}
+
+template<typename Addr>
+void run_partitioned(const Options& opt, unsigned shards) {
+    const CacheConfig& c = opt.configs[0];
+    WorkerPool pool(shards);
+    PartitionedSim<Addr> sim(c.nsets, c.bsize, c.assoc, c.repl, opt.seed, shards, pool);
+    sim.set_prefetch(opt.prefetch);
+    unique_ptr<Profile> prof = make_profile(opt, false);
+    unique_ptr<IntervalWriter> iv = make_interval(opt, 1, false);
+    auto snapshot = [&iv, &sim](uint64_t end) {
+        iv->push(end, [&sim](size_t) { return sim.stats(); });
+    };
+    TraceReader trace(opt.filename, opt.format, opt.serve ? opt.ring_size : 0, opt.compression);
+    trace.set_profile(prof.get());
+    vector<Addr> block(TraceReader::BLOCK * 16);
+    uint64_t pos = 0;
+    size_t n;
+    while ((n = trace.read(block.data(), window_read(block.size(), pos, opt.interval))) > 0) {
+        {
+            PhaseTimer t = profile_phase(prof.get(), &Profile::sim);
+            sim.route(block.data(), n);
+            sim.wait();
+        }
+        // Após wait() os contadores cobrem os blocos anteriores ao atual
+        if (iv && pos > 0 && pos % opt.interval == 0) snapshot(pos);
+        sim.start();
+        pos += n;
+    }
+    {
+        PhaseTimer t = profile_phase(prof.get(), &Profile::sim);
+        sim.wait();
+    }
+    if (iv) {
+        if (pos > 0) snapshot(pos);
+        iv->finish();
+    }
+    sim.stats().print(opt.compact);
+    if (prof) prof->print(opt.compact);
+}
+
+template<typename Addr>
+void run_hierarchy(const Options& opt) {
+    Hierarchy<Addr> h(opt.inclusion);
+    vector<CacheConfig> configs = opt.configs;
+    configs.insert(configs.end(), opt.levels.begin(), opt.levels.end());
+    for (const CacheConfig& c : configs) {
+        CacheEngine<Addr>& level = h.add_level(c.nsets, c.bsize, c.assoc, c.repl);
+        level.seed_random(opt.seed);
+        if (opt.exact_3c) level.enable_exact_3c();
+        level.prefetch_distance = opt.prefetch;
+    }
+
+    unique_ptr<Profile> prof = make_profile(opt, true);
+    unique_ptr<IntervalWriter> iv = make_interval(opt, configs.size(), false);
+    auto snapshot = [&iv, &h](uint64_t end) {
+        iv->push(end, [&h](size_t i) { return h.levels[i]->stats(); });
+    };
+    TraceReader trace(opt.filename, opt.format, opt.serve ? opt.ring_size : 0, opt.compression);
+    trace.set_profile(prof.get());
+    vector<Addr> block(TraceReader::BLOCK);
+    uint64_t pos = 0;
+    size_t n;
+    while ((n = trace.read(block.data(), window_read(block.size(), pos, opt.interval))) > 0) {
+        {
+            PhaseTimer t = profile_phase(prof.get(), &Profile::sim, true);
+            h.access_batch(block.data(), n);
+        }
+        pos += n;
+        if (iv && pos % opt.interval == 0) snapshot(pos);
+    }
+    if (iv) {
+        if (pos % opt.interval) snapshot(pos);
+        iv->finish();
+    }
+
+    for (size_t i = 0; i < configs.size(); ++i) {
+        if (!opt.compact) {
+            const CacheConfig& c = configs[i];
+            printf("Nível L%zu: %u %u %u %s\n", i + 1, c.nsets, c.bsize, c.assoc,
+                   replacement_name(c.repl));
+        }
+        h.levels[i]->print_stats(opt.compact);
+    }
+    if (prof) prof->print(opt.compact);
+}
+
+template<typename Addr>
+void run_sampled(const Options& opt) {
+    vector<unique_ptr<SampledSim<Addr>>> sims;
+    for (const CacheConfig& c : opt.configs) {
+        sims.emplace_back(new SampledSim<Addr>(c.nsets, c.bsize, c.assoc, c.repl, opt.seed, opt.sample));
+        sims.back()->set_prefetch(opt.prefetch);
+    }
+    unique_ptr<Profile> prof = make_profile(opt, true);
+    TraceReader trace(opt.filename, opt.format, opt.serve ? opt.ring_size : 0, opt.compression);
+    trace.set_profile(prof.get());
+    vector<Addr> block(TraceReader::BLOCK);
+    size_t n;
+    while ((n = trace.read(block.data(), block.size())) > 0) {
+        PhaseTimer t = profile_phase(prof.get(), &Profile::sim, true);
+        for (auto& sim : sims) sim->access_batch(block.data(), n);
+    }
+
+    for (size_t i = 0; i < sims.size(); ++i) {
+        if (opt.sweep && !opt.compact) {
+            const CacheConfig& c = opt.configs[i];
+            printf("Configuração: %u %u %u %s\n", c.nsets, c.bsize, c.assoc,
+                   replacement_name(c.repl));
+        }
+        sims[i]->print(opt.compact);
+    }
+    if (prof) prof->print(opt.compact);
+}
+
+// Pré-filtro do --collapse-runs: de cada sequência de acessos ao mesmo
+// bloco só os keep primeiros chegam ao motor. O primeiro deixa o bloco na
+// cache como o mais recente e os seguintes são hits; em LRU, FIFO, RANDOM e
+// PLRU eles não mudam o estado (keep = 1), em RRIP só o primeiro hit muda
+// (RRPV vai a 0, keep = 2). O resultado é exato; escritas repetidas mudariam
+// bits de sujo e contadores, por isso o filtro não vale para traces R/W. Com
+// bsizes diferentes usa o menor, cujo bloco está contido nos demais.
+template<typename Addr>
+class RunFilter {
+public:
+    RunFilter(uint32_t offset, uint32_t k) : offset_bits(offset), keep(k) {}
+
+    // Copia para out (que pode ser o próprio in) os acessos que iniciam uma
+    // sequência; retorna quantos
+    size_t apply(const Addr* in, size_t n, Addr* out) {
+        if (n == 0) return 0;
+        size_t m = 0;
+        Addr prev = started ? last : ~(in[0] >> offset_bits);
+        uint32_t r = run;
+        for (size_t k = 0; k < n; ++k) {
+            Addr b = in[k] >> offset_bits;
+            r = (b == prev) ? r + 1 : 0;
+            out[m] = in[k];
+            m += r < keep;
+            prev = b;
+        }
+        last = prev;
+        run = min(r, keep);
+        started = true;
+        return m;
+    }
+
+private:
+    uint32_t offset_bits, keep;
+    Addr last = 0;
+    uint32_t run = 0;       // posição na sequência do último acesso
+    bool started = false;
+};
+
+// Snapshot do --checkpoint: cabeçalho, deslocamento no trace e o estado de
+// cada configuração na ordem da linha de comando
+const char CHECKPOINT_MAGIC[8] = {'C', 'S', 'I', 'M', 'C', 'K', 'P', '1'};
+
+// Grava num arquivo temporário e renomeia, para que uma execução
+// interrompida no meio da gravação preserve o snapshot anterior
+template<typename Addr>
+void save_checkpoint(const string& filename, const vector<unique_ptr<CacheEngine<Addr>>>& caches,
+                     uint64_t offset) {
+    string tmp = filename + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        throw runtime_error("Erro ao abrir arquivo: " + tmp);
     try {
-        repl = parse_replacement(argv[4]);
-    } catch (const invalid_argument& e) {
-        cerr << e.what() << endl;
-        return 1;
+        write_pod(f, CHECKPOINT_MAGIC);
+        write_pod(f, static_cast<uint32_t>(8 * sizeof(Addr)));
+        write_pod(f, static_cast<uint32_t>(caches.size()));
+        write_pod(f, offset);
+        for (auto& c : caches) c->save(f);
+    } catch (...) {
+        fclose(f);
+        remove(tmp.c_str());
+        throw;
     }
+    if (fclose(f) != 0 || rename(tmp.c_str(), filename.c_str()) != 0)
+        throw runtime_error("Erro ao gravar checkpoint: " + filename);
+}
 
-    bool flag = strcmp(argv[5], "0");
-    string filename = argv[6];
+// Restaura as caches já construídas; retorna o deslocamento no trace
+template<typename Addr>
+uint64_t load_checkpoint(const string& filename, vector<unique_ptr<CacheEngine<Addr>>>& caches) {
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f)
+        throw runtime_error("Erro ao abrir arquivo: " + filename);
+    uint64_t offset = 0;
+    try {
+        char magic[8];
+        uint32_t bits, count;
+        read_pod(f, magic);
+        if (memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+            throw runtime_error("Erro: " + filename + " não é um checkpoint");
+        read_pod(f, bits);
+        read_pod(f, count);
+        if (bits != 8 * sizeof(Addr) || count != caches.size())
+            throw runtime_error("Erro: checkpoint incompatível com a configuração");
+        read_pod(f, offset);
+        for (auto& c : caches) c->load(f);
+    } catch (...) {
+        fclose(f);
+        throw;
+    }
+    fclose(f);
+    return offset;
+}
 
-    if ((uint64_t)nsets * bsize * assoc > UINT32_MAX) {
-        cerr << "Erro: cache maior que espaço de endereçamento 32-bit" << endl;
-        return 1;
+template<typename Addr>
+void run_caches(const Options& opt) {
+    // Todas as configurações consomem o mesmo bloco decodificado
+    vector<unique_ptr<CacheEngine<Addr>>> caches;
+    bool rw = trace_has_ops(opt.format);
+    for (const CacheConfig& c : opt.configs) {
+        caches.emplace_back(new CacheEngine<Addr>(c.nsets, c.bsize, c.assoc, c.repl));
+        caches.back()->seed_random(opt.seed);
+        if (opt.exact_3c) caches.back()->enable_exact_3c();
+        if (rw) caches.back()->enable_rw(opt.write_back, opt.write_allocate);
+        caches.back()->prefetch_distance = opt.prefetch;
+    }
+    // Os blocos de aquecimento atualizam o estado sem contar; repeats são
+    // os acessos descartados pelo --collapse-runs
+    auto simulate = [rw](CacheEngine<Addr>& c, const Addr* addrs, const uint8_t* ops, size_t n,
+                         bool warm, uint64_t repeats) {
+        if (warm) {
+            c.warm_batch(addrs, ops, n);
+            return;
+        }
+        if (rw)
+            c.access_batch_rw(addrs, ops, n);
+        else
+            c.access_batch(addrs, n);
+        c.count_repeat_hits(repeats);
+    };
+    unique_ptr<RunFilter<Addr>> runs;
+    if (opt.collapse_runs) {
+        uint32_t bsize = opt.configs[0].bsize, keep = 1;
+        for (const CacheConfig& c : opt.configs) {
+            bsize = min(bsize, c.bsize);
+            if (c.repl == Replacement::SRRIP || c.repl == Replacement::BRRIP ||
+                c.repl == Replacement::DRRIP)
+                keep = 2;
+        }
+        runs.reset(new RunFilter<Addr>(ilog2(bsize), keep));
+    }
+    auto collapse = [&runs](Addr* addrs, size_t n) {
+        return runs ? runs->apply(addrs, n, addrs) : n;
+    };
+    if (!opt.warmup_trace.empty()) {
+        TraceReader warm(opt.warmup_trace, opt.format, 0, opt.compression);
+        vector<Addr> block(TraceReader::BLOCK);
+        vector<uint8_t> ops(rw ? block.size() : 0);
+        size_t n;
+        while ((n = warm.read(block.data(), block.size(), ops.data())) > 0)
+            for (auto& cache : caches)
+                cache->warm_batch(block.data(), ops.data(), n);
     }
 
-    ifstream infile(filename, ios::binary);
-    if (!infile) {
-        cerr << "Erro ao abrir arquivo: " << filename << endl;
-        return 1;
+    unsigned workers = min<size_t>(opt.threads, caches.size());
+    unique_ptr<Profile> prof = make_profile(opt, workers <= 1);
+    unique_ptr<IntervalWriter> iv = make_interval(opt, caches.size(), rw);
+    auto stats_of = [&caches](size_t i) { return caches[i]->stats(); };
+    TraceReader trace(opt.filename, opt.format, opt.serve ? opt.ring_size : 0, opt.compression);
+    trace.set_profile(prof.get());
+    uint64_t pos = 0;
+    if (!opt.resume.empty()) {
+        pos = load_checkpoint(opt.resume, caches);
+        if (trace.skip<Addr>(pos) != pos)
+            throw runtime_error("Erro: trace menor que o deslocamento do checkpoint");
+        if (iv) iv->prime(stats_of);
     }
+    // Os blocos terminam no fim do aquecimento e nas fronteiras das janelas
+    // e dos checkpoints
+    auto next_read = [&opt](size_t max, uint64_t at) {
+        if (at < opt.warmup) max = static_cast<size_t>(min<uint64_t>(max, opt.warmup - at));
+        return window_read(window_read(max, at, opt.interval), at, opt.checkpoint_every);
+    };
+    auto block_done = [&](uint64_t end) {
+        if (iv && end > opt.warmup && end % opt.interval == 0) iv->push(end, stats_of);
+        if (opt.checkpoint_every && end % opt.checkpoint_every == 0)
+            save_checkpoint(opt.checkpoint, caches, end);
+    };
+    if (workers <= 1) {
+        vector<Addr> block(TraceReader::BLOCK);
+        vector<uint8_t> ops(rw ? block.size() : 0);
+        size_t n;
+        while ((n = trace.read(block.data(), next_read(block.size(), pos), ops.data())) > 0) {
+            {
+                PhaseTimer t = profile_phase(prof.get(), &Profile::sim, true);
+                bool warm = pos < opt.warmup;
+                size_t m = collapse(block.data(), n);
+                for (auto& cache : caches)
+                    simulate(*cache, block.data(), ops.data(), m, warm, n - m);
+            }
+            pos += n;
+            block_done(pos);
+        }
+    } else {
+        // Cada configuração é uma tarefa sobre o bloco compartilhado
+        // (somente leitura); a thread principal decodifica o próximo
+        // bloco enquanto as threads simulam o atual.
+        WorkerPool pool(workers);
+        const size_t block_size = TraceReader::BLOCK * 16;
+        vector<Addr> cur(block_size), next(block_size);
+        vector<uint8_t> cur_ops(rw ? block_size : 0), next_ops(rw ? block_size : 0);
+        size_t n = trace.read(cur.data(), next_read(cur.size(), pos), cur_ops.data());
+        size_t m = collapse(cur.data(), n);
+        while (n > 0) {
+            const Addr* data = cur.data();
+            const uint8_t* ops = cur_ops.data();
+            bool warm = pos < opt.warmup;
+            uint64_t repeats = n - m;
+            pool.start(caches.size(), [&caches, &simulate, data, ops, m, warm, repeats](size_t i) {
+                simulate(*caches[i], data, ops, m, warm, repeats);
+            });
+            size_t n_next = trace.read(next.data(), next_read(next.size(), pos + n), next_ops.data());
+            size_t m_next = collapse(next.data(), n_next);
+            {
+                PhaseTimer t = profile_phase(prof.get(), &Profile::sim);
+                pool.wait();
+            }
+            pos += n;
+            block_done(pos);
+            swap(cur, next);
+            swap(cur_ops, next_ops);
+            n = n_next;
+            m = m_next;
+        }
+    }
+    if (iv) {
+        if (pos > opt.warmup && pos % opt.interval) iv->push(pos, stats_of);
+        iv->finish();
+    }
+    if (!opt.checkpoint.empty()) save_checkpoint(opt.checkpoint, caches, pos);
+
+    for (size_t i = 0; i < caches.size(); ++i) {
+        if (opt.sweep && !opt.compact) {
+            const CacheConfig& c = opt.configs[i];
+            printf("Configuração: %u %u %u %s\n", c.nsets, c.bsize, c.assoc,
+                   replacement_name(c.repl));
+        }
+        caches[i]->print_stats(opt.compact);
+    }
+    if (prof) prof->print(opt.compact);
+}
+
+// Traces sintéticos do --bench, gerados em memória antes da medição
+struct SyntheticTrace {
+    const char* name;
+    vector<uint32_t> addrs;
+};
+
+vector<SyntheticTrace> make_bench_traces(size_t n, uint64_t seed) {
+    vector<SyntheticTrace> out;
+    auto rnd = [seed](uint64_t stream, uint64_t i) {
+        return counter_rng(seed ^ (stream * 0xD1B54A32D192ED03ull), i);
+    };
+
+    SyntheticTrace seq{"sequential", vector<uint32_t>(n)};
+    for (size_t i = 0; i < n; ++i) seq.addrs[i] = static_cast<uint32_t>(i * 4);
+    out.push_back(move(seq));
+
+    // Passo de 4 KiB: todos os acessos caem no mesmo conjunto de caches pequenas
+    SyntheticTrace strided{"strided", vector<uint32_t>(n)};
+    for (size_t i = 0; i < n; ++i) strided.addrs[i] = static_cast<uint32_t>(i * 4096 + (i >> 20) * 64);
+    out.push_back(move(strided));
 
-    Cache cache(nsets, bsize, assoc, repl);
+    // Uniforme sobre 256 MiB
+    SyntheticTrace uniform{"uniform", vector<uint32_t>(n)};
+    for (size_t i = 0; i < n; ++i) uniform.addrs[i] = rnd(1, i) & 0x0FFFFFFFu;
+    out.push_back(move(uniform));
 
-    uint32_t address;
-    while (infile.read(reinterpret_cast<char*>(&address), sizeof(uint32_t))) {
-        cache.access(swap_endian(address));
+    // Zipf (s = 0.99) sobre 2^20 blocos de 64 bytes; a posição de cada
+    // bloco é embaralhada por uma multiplicação ímpar para espalhar os quentes
+    const uint32_t zipf_blocks = 1u << 20;
+    vector<double> cdf(zipf_blocks);
+    double sum = 0;
+    for (uint32_t r = 0; r < zipf_blocks; ++r) cdf[r] = sum += 1.0 / pow(r + 1.0, 0.99);
+    SyntheticTrace zipf{"zipf", vector<uint32_t>(n)};
+    for (size_t i = 0; i < n; ++i) {
+        double u = (rnd(2, i) + 0.5) / 4294967296.0 * sum;
+        uint32_t r = static_cast<uint32_t>(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+        r = min(r, zipf_blocks - 1);
+        zipf.addrs[i] = ((r * 0x9E3779B1u) & (zipf_blocks - 1)) << 6;
+    }
+    out.push_back(move(zipf));
+
+    // Percurso de ponteiros num ciclo aleatório de 2^18 nós de 64 bytes
+    const uint32_t nodes = 1u << 18;
+    vector<uint32_t> order(nodes), next(nodes);
+    for (uint32_t i = 0; i < nodes; ++i) order[i] = i;
+    for (uint32_t i = nodes - 1; i > 0; --i) swap(order[i], order[bounded_rand(rnd(3, i), i + 1)]);
+    for (uint32_t i = 0; i < nodes; ++i) next[order[i]] = order[(i + 1) % nodes];
+    SyntheticTrace chase{"pointer-chase", vector<uint32_t>(n)};
+    uint32_t node = order[0];
+    for (size_t i = 0; i < n; ++i) {
+        chase.addrs[i] = node << 6;
+        node = next[node];
+    }
+    out.push_back(move(chase));
+    return out;
+}
+
+// Mede a vazão do motor: cada configuração processa cada trace sintético
+// em blocos do mesmo tamanho usados na leitura de arquivos
+void run_bench(const Options& opt) {
+    vector<CacheConfig> configs = opt.configs;
+    if (configs.empty()) {
+        const Replacement policies[] = {Replacement::LRU, Replacement::FIFO, Replacement::RANDOM,
+                                        Replacement::PLRU_TREE, Replacement::PLRU_BIT,
+                                        Replacement::SRRIP, Replacement::BRRIP, Replacement::DRRIP};
+        for (Replacement r : policies)
+            for (uint32_t ns : {64u, 4096u, 262144u})
+                for (uint32_t a : {1u, 4u, 16u})
+                    configs.push_back(CacheConfig{ns, 64, a, r});
+    }
+    vector<SyntheticTrace> traces = make_bench_traces(opt.bench, opt.seed);
+
+    printf("%-14s %8s %6s %6s %2s %10s %11s %9s\n", "trace", "nsets", "bsize", "assoc", "R",
+           "ns/acesso", "Macessos/s", "misses");
+    for (const SyntheticTrace& t : traces) {
+        for (const CacheConfig& c : configs) {
+            CacheEngine<> cache(c.nsets, c.bsize, c.assoc, c.repl);
+            cache.seed_random(opt.seed);
+            cache.prefetch_distance = opt.prefetch;
+            auto start = chrono::steady_clock::now();
+            for (size_t k = 0; k < t.addrs.size(); k += TraceReader::BLOCK)
+                cache.access_batch(t.addrs.data() + k, min(TraceReader::BLOCK, t.addrs.size() - k));
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            double ns = secs * 1e9 / t.addrs.size();
+            printf("%-14s %8u %6u %6u %2s %10.2lf %11.1lf %9.4lf\n", t.name, c.nsets, c.bsize,
+                   c.assoc, replacement_name(c.repl), ns, ns > 0 ? 1e3 / ns : 0.0,
+                   static_cast<double>(cache.misses) / t.addrs.size());
+        }
+    }
+}
+
+// Regrava o trace de entrada (qualquer formato aceito) no formato nativo
+template<typename Addr>
+void run_convert(const Options& opt) {
+    TraceReader in(opt.filename, opt.format, opt.serve ? opt.ring_size : 0, opt.compression);
+    NativeTraceWriter<Addr> out(opt.convert, opt.format);
+    vector<Addr> block(TraceReader::BLOCK);
+    vector<uint8_t> ops(trace_has_ops(opt.format) ? block.size() : 0);
+    size_t n;
+    while ((n = in.read(block.data(), block.size(), ops.data())) > 0)
+        out.write(block.data(), ops.data(), n);
+    out.finish();
+    printf("%" PRIu64 " acessos em %zu blocos, %" PRIu64 " bytes\n", out.records(),
+           out.chunk_count(), out.bytes());
+}
+
+// Escolhe o modo de simulação para a largura de endereço do trace
+template<typename Addr>
+void run(const Options& opt) {
+    if (!opt.convert.empty()) {
+        run_convert<Addr>(opt);
+        return;
+    }
+    if (opt.lru_curve) {
+        run_lru_curve<Addr>(opt);
+        return;
+    }
+    unsigned shards = 1;
+    while (opt.partition && shards * 2 <= opt.threads && shards * 2 <= opt.configs[0].nsets)
+        shards *= 2;
+    if (!opt.levels.empty())
+        run_hierarchy<Addr>(opt);
+    else if (opt.sample)
+        run_sampled<Addr>(opt);
+    else if (shards > 1)
+        run_partitioned<Addr>(opt, shards);
+    else
+        run_caches<Addr>(opt);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    try {
+        if (!parse_args(argc, argv, opt)) {
+            usage(argv[0]);
+            return 1;
+        }
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    try {
+        if (opt.bench)
+            run_bench(opt);
+        else if (trace_addr_bits(opt.format) == 64)
+            run<uint64_t>(opt);
+        else
+            run<uint32_t>(opt);
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
     }
 
-    cache.print_stats(flag);
     return 0;
 }